@@ -45,11 +45,13 @@
  */
 
 
+#include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/wdt.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <util/crc16.h>
 #include "dataForController_t.h"
 #include "DoubleJoy_usb_stuff.h"
 
@@ -70,32 +72,92 @@ void setControllersToZero(void){
 	sendPS3Data(emptyData,1);
 }
 
+// Timer1 runs free at F_CPU/64 and is our clock for serial timeouts.
+//  At 16 MHz each tick is 4 us, and since we compare times as signed
+//  16 bit differences, a deadline can be up to 131 ms away.
+#define TIMER_TICKS_PER_MS 250
+#define MS_TO_TICKS(ms) ((uint16_t)((ms) * TIMER_TICKS_PER_MS))
+#define US_TO_TICKS(us) ((uint16_t)((us) / 4))
+
+// How long we wait for each byte from the Arduino before giving up
+#define SERIAL_TIMEOUT MS_TO_TICKS(25)
+
+void timerInit(void){
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11)|(1<<CS10);
+}
+
+// Returns the current time, in timer ticks
+static inline uint16_t timerNow(void){
+	return TCNT1;
+}
+
+// Returns non-zero once the time has reached or passed the deadline
+static inline uint8_t deadlinePassed(uint16_t deadline){
+	return (int16_t)(timerNow() - deadline) >= 0;
+}
+
+// Incoming serial data is put into this ring buffer by the USART
+//  receive interrupt, so bytes never get lost while we're busy
+//  with the USB side of things.  The size has to be a power of two.
+#define SERIAL_RX_BUFFER_SIZE 32
+#define SERIAL_RX_BUFFER_MASK (SERIAL_RX_BUFFER_SIZE - 1)
+static volatile uint8_t serialRxBuffer[SERIAL_RX_BUFFER_SIZE];
+static volatile uint8_t serialRxHead = 0;
+static volatile uint8_t serialRxTail = 0;
+
+ISR(USART1_RX_vect){
+	uint8_t data = UDR1;
+	uint8_t nextHead = (serialRxHead + 1) & SERIAL_RX_BUFFER_MASK;
+	// If the buffer is full, the byte is dropped
+	if (nextHead != serialRxTail){
+		serialRxBuffer[serialRxHead] = data;
+		serialRxHead = nextHead;
+	}
+}
+
 // Initializes the USART to receive and transmit,
 //  takes in a value you can find in the datasheet
 //  based on desired communication and clock speeds
 void USART_Init(uint16_t baudSetting){
 	// Set baud rate
 	UBRR1 = baudSetting;
-	// Enable receiver and transmitter
-	UCSR1B = (1<<RXEN1)|(1<<TXEN1);
+	// Enable receiver, transmitter, and the receive interrupt
+	UCSR1B = (1<<RXEN1)|(1<<TXEN1)|(1<<RXCIE1);
 	// Set frame format: 8data, 1stop bit
 	UCSR1C = (1<<UCSZ10)|(1<<UCSZ11);	
 }
 
+// Returns how many received bytes are waiting in the buffer
+uint8_t serialAvailable(void){
+	return (serialRxHead - serialRxTail) & SERIAL_RX_BUFFER_MASK;
+}
+
+// Non-blocking read - if there's a byte in the buffer, this puts it
+//  in *data and returns 1.  Otherwise it returns 0 straight away.
+uint8_t serialTryRead(uint8_t* data){
+	uint8_t tail = serialRxTail;
+	if (tail == serialRxHead)
+		return 0;
+	*data = serialRxBuffer[tail];
+	serialRxTail = (tail + 1) & SERIAL_RX_BUFFER_MASK;
+	return 1;
+}
+
 // This reads the USART serial port, returning any data that's in the
-//  buffer, or a guaranteed zero if it took longer than timeout ms
-//  Input: uint_16 timeout - milliseconds to wait for data before timing out
+//  buffer, or a guaranteed zero if it took longer than timeout
+//  Input: uint_16 timeout - timer ticks to wait for data before timing out
+//         (use MS_TO_TICKS or US_TO_TICKS to make one)
 unsigned char serialRead( uint16_t timeout ){
+	uint16_t deadline = timerNow() + timeout;
+	uint8_t data;
 	// Wait for data to be received 
-	while ( !(UCSR1A & (1<<RXC1)) ){
-		_delay_ms(1);
-		timeout--;
-		if (timeout == 0){
+	while (!serialTryRead(&data)){
+		if (deadlinePassed(deadline)){
 			return 0b0;
-		}			
-	}	
-	// Get and return received data from buffer 
-	return UDR1;
+		}
+	}
+	return data;
 }
 
 // This sends out a byte of data via the USART.
@@ -108,6 +170,12 @@ void serialWrite( unsigned char data )
 	UDR1 = data;
 }
 
+// Throws away anything sitting in the receive buffer
+void flushSerialRead()
+{
+	serialRxTail = serialRxHead;
+}
+
 // This turns on one of the LEDs hooked up to the chip
 void LEDon(char ledNumber){
 	DDRD |= 1 << ledNumber;
@@ -120,12 +188,183 @@ void LEDoff(char ledNumber){
 	PORTD |= 1 << ledNumber;
 }
 
+// Waits for a byte until the deadline.  Returns 1 and puts the
+//  byte in *data if one came in, or 0 if we ran out of time.
+uint8_t serialReadBefore(uint8_t* data, uint16_t deadline){
+	while (!serialTryRead(data)){
+		if (deadlinePassed(deadline))
+			return 0;
+	}
+	return 1;
+}
+
+// These have to match the codes in DoubleJoy.h on the Arduino side.
+//  SERIAL_SNAPSHOT_REQUEST asks for both controllers' data at once,
+//  which comes back as a frame:
+//    SERIAL_FRAME_START, DOUBLE_DATA_SIZE, controller 1's seven bytes,
+//    controller 2's seven bytes, then a CRC-8 of the length and data bytes.
+#define SERIAL_SNAPSHOT_REQUEST 0xF0
+#define SERIAL_FRAME_START 0xA5
+#define DOUBLE_DATA_SIZE (2 * CONTROLLER_DATA_SIZE)
+// SERIAL_PRESSURE_REQUEST asks for the same frame with button pressures
+//  added after each controller's seven bytes: two bytes, low byte first,
+//  with a bit set for each of the PRESSURE_COUNT buttons that has one,
+//  then one byte for each of those buttons, in order.  Buttons without
+//  a pressure are left out, so a sketch that doesn't use them only makes
+//  the frame four bytes longer.
+#define SERIAL_PRESSURE_REQUEST 0xF1
+#define PRESSURE_FRAME_MIN_SIZE (2 * (CONTROLLER_DATA_SIZE + 2))
+#define PRESSURE_FRAME_MAX_SIZE (2 * (CONTROLLER_DATA_SIZE + 2 + PRESSURE_COUNT))
+
+// Asks the Arduino for both controllers' data in one go.
+//  Returns 0 if we got a good frame, which is copied into doubleBytes,
+//  or 1 if we didn't, in which case doubleBytes is left alone.
+uint8_t getSnapshotFromArduino(uint8_t* doubleBytes){
+	uint8_t frameBytes[DOUBLE_DATA_SIZE];
+	uint8_t data, crc;
+	flushSerialRead();
+	serialWrite(SERIAL_SNAPSHOT_REQUEST);
+	uint16_t deadline = timerNow() + SERIAL_TIMEOUT;
+	// Skip anything that isn't the start of a frame
+	do {
+		if (!serialReadBefore(&data, deadline))
+			return 1;
+	} while (data != SERIAL_FRAME_START);
+	if (!serialReadBefore(&data, deadline) || data != DOUBLE_DATA_SIZE)
+		return 1;
+	crc = _crc_ibutton_update(0, data);
+	for (uint8_t i = 0; i < DOUBLE_DATA_SIZE; i++){
+		if (!serialReadBefore(&frameBytes[i], deadline))
+			return 1;
+		crc = _crc_ibutton_update(crc, frameBytes[i]);
+	}
+	if (!serialReadBefore(&data, deadline) || data != crc)
+		return 1;
+	memcpy(doubleBytes, frameBytes, DOUBLE_DATA_SIZE);
+	return 0;
+}
+
+// Asks the Arduino for both controllers' data and button pressures.
+//  Returns 0 if we got a good frame, which is unpacked into doubleBytes
+//  and pressures, or 1 if we didn't, in which case they're left alone.
+uint8_t getPressureSnapshotFromArduino(uint8_t* doubleBytes, uint8_t pressures[2][PRESSURE_COUNT]){
+	uint8_t frameBytes[PRESSURE_FRAME_MAX_SIZE];
+	uint8_t newBytes[DOUBLE_DATA_SIZE];
+	uint8_t newPressures[2][PRESSURE_COUNT];
+	uint8_t length, data, crc;
+	flushSerialRead();
+	serialWrite(SERIAL_PRESSURE_REQUEST);
+	uint16_t deadline = timerNow() + SERIAL_TIMEOUT;
+	// Skip anything that isn't the start of a frame
+	do {
+		if (!serialReadBefore(&data, deadline))
+			return 1;
+	} while (data != SERIAL_FRAME_START);
+	if (!serialReadBefore(&length, deadline) ||
+	    length < PRESSURE_FRAME_MIN_SIZE || length > PRESSURE_FRAME_MAX_SIZE)
+		return 1;
+	crc = _crc_ibutton_update(0, length);
+	for (uint8_t i = 0; i < length; i++){
+		if (!serialReadBefore(&frameBytes[i], deadline))
+			return 1;
+		crc = _crc_ibutton_update(crc, frameBytes[i]);
+	}
+	if (!serialReadBefore(&data, deadline) || data != crc)
+		return 1;
+	// Now unpack it, making sure the pressure bits add up to the length
+	const uint8_t* frame = frameBytes;
+	const uint8_t* frameEnd = frameBytes + length;
+	for (uint8_t player = 0; player < 2; player++){
+		if (frameEnd - frame < CONTROLLER_DATA_SIZE + 2)
+			return 1;
+		memcpy(newBytes + player * CONTROLLER_DATA_SIZE, frame, CONTROLLER_DATA_SIZE);
+		frame += CONTROLLER_DATA_SIZE;
+		uint16_t sent = frame[0] | (frame[1] << 8);
+		frame += 2;
+		for (uint8_t i = 0; i < PRESSURE_COUNT; i++, sent >>= 1){
+			newPressures[player][i] = 0;
+			if (sent & 1){
+				if (frame == frameEnd)
+					return 1;
+				newPressures[player][i] = *frame++;
+			}
+		}
+	}
+	if (frame != frameEnd)
+		return 1;
+	memcpy(doubleBytes, newBytes, DOUBLE_DATA_SIZE);
+	memcpy(pressures, newPressures, sizeof(newPressures));
+	return 0;
+}
+
+// This gets the controller data the old way, by asking for each
+//  byte in turn, for sketches built with older copies of DoubleJoy.h.
+//  Any byte that times out keeps its old value.
+//  Returns 0 if every byte came back, or 1 if any timed out.
+uint8_t getBytewiseFromArduino(uint8_t* doubleBytes){
+	uint8_t result = 0;
+	flushSerialRead();
+	for (uint8_t i = 0; i < DOUBLE_DATA_SIZE; i++){
+		serialWrite(i);
+		if (!serialReadBefore(&doubleBytes[i], timerNow() + SERIAL_TIMEOUT))
+			result = 1;
+	}
+	return result;
+}
+
+// The ways we can ask the Arduino for its data, oldest first
+#define FETCH_BYTEWISE 0
+#define FETCH_SNAPSHOT 1
+#define FETCH_PRESSURE 2
+
+// Gets the data using one of the FETCH_ ways.
+//  Returns 0 if it all came back, or 1 if it didn't.
+uint8_t fetchFromArduino(uint8_t method, uint8_t* doubleBytes, uint8_t pressures[2][PRESSURE_COUNT]){
+	uint8_t result;
+	if (method == FETCH_PRESSURE)
+		return getPressureSnapshotFromArduino(doubleBytes, pressures);
+	if (method == FETCH_SNAPSHOT)
+		result = getSnapshotFromArduino(doubleBytes);
+	else
+		result = getBytewiseFromArduino(doubleBytes);
+	// Those don't carry pressures, so don't leave old ones lying around
+	memset(pressures, 0, 2 * PRESSURE_COUNT);
+	return result;
+}
+
+// If the newer ways keep failing while an older one works,
+//  the sketch is using an old DoubleJoy.h, so we stop asking for them
+#define SNAPSHOT_FAILURE_LIMIT 3
+
+// Gets the controller data and pressures for both players from the Arduino
+void getDataFromArduino(uint8_t* doubleBytes, uint8_t pressures[2][PRESSURE_COUNT]){
+	static uint8_t method = FETCH_PRESSURE;
+	static uint8_t failures = 0;
+	if (fetchFromArduino(method, doubleBytes, pressures) == 0){
+		failures = 0;
+		return;
+	}
+	// Try each older way in turn, until one works
+	for (uint8_t older = method; older-- > 0; ){
+		if (fetchFromArduino(older, doubleBytes, pressures) == 0){
+			if (++failures >= SNAPSHOT_FAILURE_LIMIT){
+				method = older;
+				failures = 0;
+			}
+			return;
+		}
+	}
+}
+
 int main(void) {
 	// Make sure our watchdog timer is disabled!
 	wdt_reset(); 
 	MCUSR &= ~(1 << WDRF); 
 	wdt_disable();
 
+	// Start the timer we use for serial timeouts
+	timerInit();
+
 	// Start up the USART for serial communications
 	// 25 corresponds to 38400 baud - see datasheet for more values
 	USART_Init(25);// 103 corresponds to 9600, 8 corresponds to 115200 baud, 3 for 250000
@@ -147,123 +386,34 @@ int main(void) {
 	// This wait also gives the Arduino bootloader time to timeout,
 	//  so the serial data you'll be properly aligned.
 	//_delay_ms(500);
-	dataForController_t dataToSend;
-	char buttonData1;
-	char buttonData2;
-	char buttonData3;
+	// Both controllers' data, as the Arduino sends it, with the sticks
+	//  centered until we hear otherwise
+	uint8_t doubleBytes[DOUBLE_DATA_SIZE];
+	memset(doubleBytes, 0, sizeof(doubleBytes));
+	doubleBytes[3] = doubleBytes[4] = doubleBytes[5] = doubleBytes[6] = 128;
+	doubleBytes[10] = doubleBytes[11] = doubleBytes[12] = doubleBytes[13] = 128;
+	// And their button pressures, if the Arduino sends any
+	uint8_t pressures[2][PRESSURE_COUNT];
+	memset(pressures, 0, sizeof(pressures));
 
 	while (1) {
-		// Delay so we're not going too fast
-		_delay_ms(10);
+		// Delay so we're not going faster than the host polls us
+		_delay_ms(GAMEPAD_INTERVAL);
 		
-        // We get our data from the ATmega328p by writing which byte we
-        //  want from the dataForController_t, and then wait for the
-        //  ATmega328p to send that back to us.
-        // The serialRead(number) function reads the serial port, and the
-        //  number is a timeout (in ms) so if there's a transmission error,
-        //  we don't stall forever.
+        // We get the data for both controllers from the ATmega328p in
+        //  one go, so they're both from the same moment.
+        // Every read has a timeout (SERIAL_TIMEOUT) so if there's a
+        //  transmission error, we don't stall forever.
 		LEDon(TXLED);
-		serialWrite(0);
-		buttonData1 = serialRead(25);
-        
-		serialWrite(1);
-		buttonData2 = serialRead(25);
-        
-		serialWrite(2);
-		buttonData3 = serialRead(25);
-        
-		serialWrite(3);
-		dataToSend.leftStickX = serialRead(25);
-        
-		serialWrite(4);
-		dataToSend.leftStickY = serialRead(25);
-        
-		serialWrite(5);
-		dataToSend.rightStickX = serialRead(25);
-        
-		serialWrite(6);
-		dataToSend.rightStickY= serialRead(25);
-		
-		LEDoff(TXLED);
-		
-		// Now, we take the button data we got in and input that information
-        //  into our controller data we want to send
-		dataToSend.triangleOn = 1 & (buttonData1 >> 0);
-		dataToSend.circleOn = 1 & (buttonData1 >> 1);
-		dataToSend.squareOn = 1 & (buttonData1 >> 2);
-		dataToSend.crossOn = 1 & (buttonData1 >> 3);
-		dataToSend.l1On = 1 & (buttonData1 >> 4);
-		dataToSend.l2On = 1 & (buttonData1 >> 5);
-		dataToSend.l3On = 1 & (buttonData1 >> 6);
-		dataToSend.r1On = 1 & (buttonData1 >> 7);
-		
-		dataToSend.r2On = 1 & (buttonData2 >> 0);
-		dataToSend.r3On = 1 & (buttonData2 >> 1);
-		dataToSend.selectOn = 1 & (buttonData2 >> 2);
-		dataToSend.startOn = 1 & (buttonData2 >> 3);
-		dataToSend.homeOn = 1 & (buttonData2 >> 4);
-		dataToSend.dpadLeftOn = 1 & (buttonData2 >> 5);
-		dataToSend.dpadUpOn = 1 & (buttonData2 >> 6);
-		dataToSend.dpadRightOn = 1 & (buttonData2 >> 7);
-		
-		dataToSend.dpadDownOn = 1 & (buttonData3 >> 0);
-		
-        
-        // Finally, we send the data out via the USB port
-		sendPS3Data(dataToSend, 1);	
-		
-		// Then do it all again for the second controller.  Not a good practice.
-		//  It should be refactored, but never will be.
-		//  Still, it works.
-	    LEDon(TXLED);
-		serialWrite(7);
-		buttonData1 = serialRead(25);
-        
-		serialWrite(8);
-		buttonData2 = serialRead(25);
-        
-		serialWrite(9);
-		buttonData3 = serialRead(25);
-        
-		serialWrite(10);
-		dataToSend.leftStickX = serialRead(25);
-        
-		serialWrite(11);
-		dataToSend.leftStickY = serialRead(25);
-        
-		serialWrite(12);
-		dataToSend.rightStickX = serialRead(25);
-        
-		serialWrite(13);
-		dataToSend.rightStickY= serialRead(25);
-		
+		getDataFromArduino(doubleBytes, pressures);
 		LEDoff(TXLED);
 		
-		// Now, we take the button data we got in and input that information
-        //  into our controller data we want to send
-		dataToSend.triangleOn = 1 & (buttonData1 >> 0);
-		dataToSend.circleOn = 1 & (buttonData1 >> 1);
-		dataToSend.squareOn = 1 & (buttonData1 >> 2);
-		dataToSend.crossOn = 1 & (buttonData1 >> 3);
-		dataToSend.l1On = 1 & (buttonData1 >> 4);
-		dataToSend.l2On = 1 & (buttonData1 >> 5);
-		dataToSend.l3On = 1 & (buttonData1 >> 6);
-		dataToSend.r1On = 1 & (buttonData1 >> 7);
-		
-		dataToSend.r2On = 1 & (buttonData2 >> 0);
-		dataToSend.r3On = 1 & (buttonData2 >> 1);
-		dataToSend.selectOn = 1 & (buttonData2 >> 2);
-		dataToSend.startOn = 1 & (buttonData2 >> 3);
-		dataToSend.homeOn = 1 & (buttonData2 >> 4);
-		dataToSend.dpadLeftOn = 1 & (buttonData2 >> 5);
-		dataToSend.dpadUpOn = 1 & (buttonData2 >> 6);
-		dataToSend.dpadRightOn = 1 & (buttonData2 >> 7);
-		
-		dataToSend.dpadDownOn = 1 & (buttonData3 >> 0);
-		
-        
-		sendPS3Data(dataToSend, 2);	
-		
-	//	usb_gamepad_send();
+        // Finally, we send the data out via the USB port.  Both reports
+        //  are loaded into the endpoint back to back, so the host gets
+        //  them on consecutive polls and neither player is behind.
+        //  The pressures only go to the PS3 - the library in the PS2
+        //  folder isn't hooked up to this firmware yet.
+		sendPS3Report(doubleBytes, pressures[0], 1);
+		sendPS3Report(doubleBytes + CONTROLLER_DATA_SIZE, pressures[1], 2);
 	}
 }
\ No newline at end of file
@@ -91,8 +91,13 @@
 #define GAMEPAD_0_REPORT_ID 1
 #define GAMEPAD_1_REPORT_ID 2
 
-#define GAMEPAD_SIZE		64
-#define GAMEPAD_BUFFER	EP_SINGLE_BUFFER //EP_DOUBLE_BUFFER
+// We double buffer the endpoint, so both players' reports can be
+//  loaded back to back and the host picks them up on its next two
+//  polls.  The 8u2 only has 176 bytes of endpoint memory, so two 64
+//  byte banks won't fit next to endpoint 0.  Our reports are 20
+//  bytes, report ID included, so the banks are 32 bytes each instead.
+#define GAMEPAD_SIZE		32
+#define GAMEPAD_BUFFER	EP_DOUBLE_BUFFER
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(GAMEPAD_SIZE) | GAMEPAD_BUFFER,
@@ -288,7 +293,7 @@ static uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	GAMEPAD_0_ENDPOINT | 0x80,		// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	GAMEPAD_SIZE, 0,			// wMaxPacketSize
-	10					// bInterval
+	GAMEPAD_INTERVAL			// bInterval
 };
 
 // If you're desperate for a little extra code memory, these strings
@@ -432,139 +437,136 @@ inline void usb_gamepad_1_reset_state(void) {
 }
 
 
-// sendPS3Data takes in a PhysicalButtonList data struct,
-//  maps the data to the format for our gamepad packet,
-//  sends that data out via USB,  and outputs
-//  a return code (zero if no problems, one if problems
-int8_t sendPS3Data(dataForController_t btnList, uint8_t playerNumber){
-	gamepad_state.id = playerNumber;
-	
-	gamepad_state.triangle_btn = btnList.triangleOn;//Button 4
-	gamepad_state.square_btn = btnList.squareOn;	
-	gamepad_state.cross_btn = btnList.crossOn;
-	gamepad_state.circle_btn = btnList.circleOn;
-
-	gamepad_state.l1_btn = btnList.l1On;
-	gamepad_state.r1_btn = btnList.r1On;
-	gamepad_state.l2_btn = btnList.l2On;
-	gamepad_state.r2_btn = btnList.r2On;
-	
-	
-	if (gamepad_state.triangle_btn == 1)
-		gamepad_state.triangle_axis = 0xFF;
-	else
-		gamepad_state.triangle_axis = 0;
-		
-	if (gamepad_state.square_btn == 1)
-		gamepad_state.square_axis = 0xFF;
-	else
-		gamepad_state.square_axis = 0;
-
-	if (gamepad_state.cross_btn == 1)
-		gamepad_state.cross_axis = 0xFF;
-	else
-		gamepad_state.cross_axis = 0;
-
-	if (gamepad_state.circle_btn == 1)
-		gamepad_state.circle_axis = 0xFF;
-	else
-		gamepad_state.circle_axis = 0;
-
-	if (gamepad_state.l1_btn == 1)
-		gamepad_state.l1_axis = 0xFF;
-	else
-		gamepad_state.l1_axis = 0;
-		
-	if (gamepad_state.l2_btn == 1)
-		gamepad_state.l2_axis = 0xFF;
-	else
-		gamepad_state.l2_axis = 0;
-		
-	if (gamepad_state.r1_btn == 1)
-		gamepad_state.r1_axis = 0xFF;
-	else
-		gamepad_state.r1_axis = 0;
-			
-	if (gamepad_state.r2_btn == 1)
-		gamepad_state.r2_axis = 0xFF;
-	else
-		gamepad_state.r2_axis = 0;
-		
-	gamepad_state.select_btn = btnList.selectOn;
-	gamepad_state.start_btn = btnList.startOn;
-	gamepad_state.l3_btn = btnList.l3On;
-	gamepad_state.r3_btn = btnList.r3On;
-	
-	//gamepad_state.r2_btn_alt = btnList.r2On;
-	//gamepad_state.l2_btn_alt = btnList.l2On;
-	gamepad_state.ps_btn = btnList.homeOn;
-
-	// digital direction, use the dir_* constants(enum)
-	// 8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
-	// 4 = down, 5 = down/left, 6 = left, 7 = left/up
-
-	gamepad_state.direction = 8;
-	if (btnList.dpadUpOn == 1){
-		if (btnList.dpadLeftOn == 1){
-			gamepad_state.direction = 7;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			gamepad_state.direction = 1;
+// These tables turn the controller data from the Arduino straight into
+//  our PS3 report.  See dataForController_t.h for the layout - the first
+//  three bytes are the button bits:
+//    byte 0: triangle, circle, square, cross, l1, l2, l3, r1
+//    byte 1: r2, r3, select, start, home, dpad left, dpad up, dpad right
+//    byte 2: dpad down
+//  and the last four are the stick positions.
+
+// Where each bit of the report's two button bytes comes from,
+//  as {controller byte, bit mask} pairs, in gamepad_state_t order
+static const uint8_t PROGMEM ps3_button_map[16][2] = {
+	{0, 1<<2}, {0, 1<<3}, {0, 1<<1}, {0, 1<<0},	// square, cross, circle, triangle
+	{0, 1<<4}, {0, 1<<7}, {0, 1<<5}, {1, 1<<0},	// l1, r1, l2, r2
+	{1, 1<<2}, {1, 1<<3}, {0, 1<<6}, {1, 1<<1},	// select, start, l3, r3
+	{1, 1<<4}, {0, 0}, {0, 0}, {0, 0}		// ps, then padding
+};
+
+// Where each of the analog pressure bytes comes from, in the
+//  same order as they appear in gamepad_state_t, for buttons
+//  the Arduino didn't send a pressure for.  Those are either
+//  0x00 or 0xFF.
+static const uint8_t PROGMEM ps3_pressure_map[8][2] = {
+	{0, 1<<0}, {0, 1<<1}, {0, 1<<3}, {0, 1<<2},	// triangle, circle, cross, square
+	{0, 1<<4}, {0, 1<<7}, {0, 1<<5}, {1, 1<<0}	// l1, r1, l2, r2
+};
+
+// This turns the d-pad into a hat switch direction.  It's indexed by
+//  the d-pad bits as {left, up, right, down}, bit 0 first, and gives
+//  8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
+//  4 = down, 5 = down/left, 6 = left, 7 = left/up
+//  Up wins over down, and left wins over right.
+static const uint8_t PROGMEM ps3_hat_map[16] = {
+	8, 6, 0, 7, 2, 6, 1, 7, 4, 5, 0, 7, 3, 5, 1, 7
+};
+
+// This writes the report for the controller data straight into
+//  the endpoint FIFO.  The endpoint has to be selected already.
+static void usb_gamepad_write_report(const uint8_t *controller_bytes, const uint8_t *pressures, uint8_t playerNumber) {
+	const uint8_t *map = &ps3_button_map[0][0];
+	uint8_t i, j, bits, bit, pressure;
+
+	UEDATX = playerNumber;
+	for (i=0; i<2; i++) {
+		bits = 0;
+		for (bit=1, j=0; j<8; j++, bit<<=1, map+=2) {
+			if (controller_bytes[pgm_read_byte(map)] & pgm_read_byte(map+1))
+				bits |= bit;
 		}
-		else
-			gamepad_state.direction = 0;
-		
+		UEDATX = bits;
 	}
-	else if (btnList.dpadDownOn == 1){
-				if (btnList.dpadLeftOn == 1){
-			gamepad_state.direction = 5;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			gamepad_state.direction = 3;
-		}
-		else
-			gamepad_state.direction = 4;		
+	UEDATX = pgm_read_byte(&ps3_hat_map[(controller_bytes[1] >> 5) | ((controller_bytes[2] & 1) << 3)]);
+	for (i=3; i<7; i++) {
+		UEDATX = controller_bytes[i];
 	}
-	else if (btnList.dpadLeftOn == 1){
-		gamepad_state.direction = 6;
+	// The unknown bytes
+	for (i=0; i<4; i++) {
+		UEDATX = 0;
 	}
-	else if (btnList.dpadRightOn == 1){
-		gamepad_state.direction = 2;
+	map = &ps3_pressure_map[0][0];
+	for (i=0; i<8; i++, map+=2) {
+		pressure = pressures ? pressures[PS3_PRESSURE_START + i] : 0;
+		// 0 - 1 is 0xFF, so this gives us 0xFF for a pressed button
+		if (!pressure)
+			pressure = -(uint8_t)((controller_bytes[pgm_read_byte(map)] & pgm_read_byte(map+1)) != 0);
+		UEDATX = pressure;
 	}
-			
-
-	// left and right analog sticks, 0x00 left/up, 0x80 middle, 0xff right/down
-
-	gamepad_state.l_x_axis = btnList.leftStickX;
-	gamepad_state.l_y_axis = btnList.leftStickY;
-	gamepad_state.r_x_axis = btnList.rightStickX;
-	gamepad_state.r_y_axis = btnList.rightStickY;
-	
-	// Send the data out via USB
-	return usb_gamepad_send();
 }
 
-int8_t usb_gamepad_send(void) {
-	uint8_t intr_state, timeout, i;
+// This waits for the endpoint to be ready for a new report.
+//  Returns 0 with the endpoint selected and interrupts off,
+//  or -1 if it timed out or the USB went away.
+static int8_t usb_gamepad_wait_ready(uint8_t *intr_state) {
+	uint8_t timeout;
 
 	if (!usb_configuration) return -1;
-	intr_state = SREG;
+	*intr_state = SREG;
 	cli();
 	UENUM = GAMEPAD_0_ENDPOINT;
 	timeout = UDFNUML + 50;
 	while (1) {
 		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
+		if (UEINTX & (1<<RWAL)) return 0;
+		SREG = *intr_state;
 		// has the USB gone offline?
 		if (!usb_configuration) return -1;
 		// have we waited too long?
 		if (UDFNUML == timeout) return -1;
 		// get ready to try checking again
-		intr_state = SREG;
+		*intr_state = SREG;
 		cli();
 		UENUM = GAMEPAD_0_ENDPOINT;
 	}
+}
+
+// sendPS3Report takes in one player's controller data, as the seven
+//  bytes the Arduino sends us, their PRESSURE_COUNT button pressures
+//  (or 0 if there aren't any), and the player number, builds our
+//  gamepad packet for that player right in the USB endpoint, and
+//  outputs a return code (zero if no problems)
+int8_t sendPS3Report(const uint8_t *controller_bytes, const uint8_t *pressures, uint8_t playerNumber){
+	uint8_t intr_state;
+
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
+	usb_gamepad_write_report(controller_bytes, pressures, playerNumber);
+	UEINTX = 0x3A;
+	SREG = intr_state;
+	return 0;
+}
+
+// sendPS3Data takes in a dataForController_t and the player number,
+//  and sends it out the same way as sendPS3Report
+int8_t sendPS3Data(dataForController_t btnList, uint8_t playerNumber){
+	uint8_t controller_bytes[CONTROLLER_DATA_SIZE];
+
+	// The button bits are laid out just like the Arduino sends them,
+	//  but the sticks aren't byte aligned, so we pick those out
+	memcpy(controller_bytes, &btnList, 3);
+	controller_bytes[2] &= 1;
+	controller_bytes[3] = btnList.leftStickX;
+	controller_bytes[4] = btnList.leftStickY;
+	controller_bytes[5] = btnList.rightStickX;
+	controller_bytes[6] = btnList.rightStickY;
+	return sendPS3Report(controller_bytes, 0, playerNumber);
+}
+
+// usb_gamepad_send sends whatever's in gamepad_state
+int8_t usb_gamepad_send(void) {
+	uint8_t intr_state, i;
+
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
 	for (i=0; i<sizeof(gamepad_state_t); i++) {
 		UEDATX = ((uint8_t*)&gamepad_state)[i];
 	}
@@ -10,6 +10,15 @@
 // Timeout in ms for the USB communication to start during initialization
 #define USB_TIMEOUT 1000
 
+// How often, in ms, we ask the host to poll us for a report.
+//  Build with FAST_POLL defined (add -DFAST_POLL to the compiler flags)
+//  to be polled every ms, for 1000 reports a second instead of 100.
+#ifdef FAST_POLL
+#define GAMEPAD_INTERVAL 1
+#else
+#define GAMEPAD_INTERVAL 10
+#endif
+
 uint8_t usb_init(void);			// initialize everything
 uint8_t usb_configured(void);		// is the USB port configured
 
@@ -69,7 +78,20 @@ void usb_gamepad_0_reset_state(void);
 
 int8_t usb_gamepad_send(void);
 
+// The controller data for one player is seven bytes on the wire
+#define CONTROLLER_DATA_SIZE 7
+
+// Each player can also have a pressure for these buttons, in this order:
+//  dpad right, dpad left, dpad up, dpad down, triangle, circle, cross,
+//  square, l1, r1, l2, r2
+//  That's the order the PS2 sends them in.  A pressure of 0 means the
+//  button doesn't have one, and it's just all the way on or off.
+#define PRESSURE_COUNT 12
+// The PS3 report only has the pressures from triangle on
+#define PS3_PRESSURE_START 4
+
 int8_t sendPS3Data(dataForController_t, uint8_t);
+int8_t sendPS3Report(const uint8_t *controller_bytes, const uint8_t *pressures, uint8_t playerNumber);
 
 
 // Everything below this point is only intended for usb_gamepad.c
@@ -0,0 +1,280 @@
+/*  PS2ConsoleEmulator.cpp
+ *
+ *  This is a little tool that plays the part of a PlayStation 2 talking to
+ *   PS2interface.c, so you can check the library on a PC instead of
+ *   plugging it into a real console every time you change something.
+ *  It builds the library for the PC (the hostAVR folder has stand-ins for
+ *   the AVR headers), then runs through a script of packets - polls,
+ *   all of the config commands, and a memory card packet that isn't for
+ *   us - driving Attention and clocking each byte in and out the same way
+ *   the console does.  For every byte it checks what we sent back, and that
+ *   we pulsed ACK, or didn't when we shouldn't have.
+ *
+ *  To build it:
+ *      g++ -Wall -Wextra -I hostAVR -o PS2ConsoleEmulator PS2ConsoleEmulator.cpp
+ *
+ *  To use it:
+ *      ./PS2ConsoleEmulator        (prints a line per packet, and any problems)
+ *      ./PS2ConsoleEmulator -v     (prints every byte)
+ *  It exits with 0 if everything was right, or 1 if anything wasn't.
+ *
+ *  It only checks what gets sent, not how fast.  On a PC we can't tell how
+ *   long the SPI interrupt takes on the AVR, so it can't tell whether ACK
+ *   would come in time for a real console.  checkAckTiming.sh, in this
+ *   folder, counts that from the AVR build instead.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The library itself, built for the PC
+#include "../PS2interface.c"
+
+HostRegister SPDR, SPCR, SREG;
+HostRegister PORTB, DDRB, PINB, PORTC, DDRC, PINC, PIND;
+HostRegister PCMSK0, PCICR;
+
+int verbose = 0;
+
+// What we saw the library do during the last interrupt
+uint8_t spdrLoaded;
+uint8_t ackLow;
+int ackPulses;
+
+// The byte the SPI unit shifts out for the next byte.  If the interrupt
+//  didn't load SPDR, what's left in the shift register is the byte we just
+//  got from the console, so that's what goes back out.
+uint8_t nextOut;
+
+int problems = 0;
+int bytesExchanged = 0;
+
+void watchSPDR(HostRegister*, uint8_t){
+	spdrLoaded = 1;
+}
+
+// Looks for ACK going low, then back high
+void watchACK(HostRegister* reg, uint8_t oldValue){
+	uint8_t was = oldValue & (1<<ACK);
+	uint8_t is = reg->value & (1<<ACK);
+	if (was && !is)
+		ackLow = 1;
+	else if (!was && is && ackLow){
+		ackLow = 0;
+		ackPulses++;
+	}
+}
+
+// Moves Attention, and runs the pin change interrupt like the AVR would
+void setAttention(uint8_t high){
+	if (high)
+		PINB.value |= (1<<ATT);
+	else
+		PINB.value &= ~(1<<ATT);
+	spdrLoaded = 0;
+	PCINT0_vect();
+	if (spdrLoaded)
+		nextOut = SPDR.value;
+}
+
+// Clocks one byte each way, then runs the SPI interrupt.
+//  Returns the byte we got back, and sets *acked if the library pulsed ACK.
+uint8_t exchangeByte(uint8_t command, uint8_t* acked){
+	uint8_t data = nextOut;
+	bytesExchanged++;
+
+	// The byte from the console is in SPDR now, and SPIF fires the interrupt
+	SPDR.value = command;
+	spdrLoaded = 0;
+	ackLow = 0;
+	ackPulses = 0;
+	SPI_STC_vect();
+	nextOut = spdrLoaded ? SPDR.value : command;
+	if (ackLow){
+		printf("    ACK was left low\n");
+		problems++;
+	}
+	if (ackPulses > 1){
+		printf("    ACK was pulsed %d times for one byte\n", ackPulses);
+		problems++;
+	}
+	*acked = ackPulses > 0;
+	return data;
+}
+
+// One packet of the script
+typedef struct scriptPacket_t
+{
+	const char* name;
+	const char* command;	// What the console sends - it sends 0x00 once that runs out
+	const char* expected;	// What we should send back, and the console stops after the last one
+	int updateAfterByte;	// If it's not -1, the library gets the second set of controller data
+							//  after this byte, while Attention is still low
+} scriptPacket_t;
+
+// The controller data for the script.  The first set goes in before we start.
+dataForController_t firstData, secondData;
+uint8_t firstPressures[PS2_PRESSURE_COUNT], secondPressures[PS2_PRESSURE_COUNT];
+
+#define FIRST_POLL  "FF 79 5A E7 BE 30 40 10 20 00 00 FF 00 00 00 FF 00 00 00 40 00"
+#define SECOND_POLL "FF 79 5A FF D7 80 80 80 80 00 00 00 00 00 7F 00 00 00 FF 00 00"
+
+const scriptPacket_t script[] = {
+	{"poll",                  "01 42", FIRST_POLL, -1},
+	{"poll, updated halfway", "01 42", FIRST_POLL, 5},
+	{"poll after the update", "01 42", SECOND_POLL, -1},
+	{"0x45 outside config",   "01 45 00", "FF 79 5A 03 02 01 02 01 00", -1},
+	{"0x43 enter config",     "01 43 00 01", SECOND_POLL, -1},
+	{"0x45 status",           "01 45 5A", "FF F3 5A 03 02 01 02 01 00", -1},
+	{"0x46 argument 0",       "01 46 00 00", "FF F3 5A 00 00 00 02 00 0A", -1},
+	{"0x46 argument 1",       "01 46 00 01", "FF F3 5A 00 00 00 00 00 14", -1},
+	{"0x47",                  "01 47 00 00", "FF F3 5A 00 00 02 00 00 00", -1},
+	{"0x4C argument 0",       "01 4C 00 00", "FF F3 5A 00 00 00 04 00 00", -1},
+	{"0x4C argument 1",       "01 4C 00 01", "FF F3 5A 00 00 00 06 00 00", -1},
+	{"0x44 analog mode",      "01 44 00 01 03", "FF F3 5A 00 00 00 00 00 00", -1},
+	{"0x4D vibration map",    "01 4D 00 00 01 FF FF FF FF", "FF F3 5A 00 01 FF FF FF FF", -1},
+	{"0x4F pressure bytes",   "01 4F 00 FF FF 03 00 00 00", "FF F3 5A 00 00 00 00 00 5A", -1},
+	{"0x41 poll contents",    "01 41 00 5A 5A 5A 5A 5A 5A", "FF F3 5A FF FF 03 00 00 5A", -1},
+	{"0x43 exit config",      "01 43 00 00 5A 5A 5A 5A 5A", "FF F3 5A 00 00 00 00 00 00", -1},
+	{"poll after config",     "01 42", SECOND_POLL, -1},
+	{"memory card",           "81 42", "FF", -1},
+};
+
+// Reads a string of hex bytes, returning how many there were
+int parseBytes(const char* text, uint8_t* bytes, int maxBytes){
+	int count = 0;
+	char* end;
+	while (count < maxBytes){
+		unsigned long value = strtoul(text, &end, 16);
+		if (end == text)
+			break;
+		bytes[count++] = value;
+		text = end;
+	}
+	return count;
+}
+
+// Runs one packet of the script, returning the number of problems
+int runPacket(const scriptPacket_t* packet){
+	uint8_t command[32], expected[32], received[32];
+	int commandLength = parseBytes(packet->command, command, 32);
+	int expectedLength = parseBytes(packet->expected, expected, 32);
+	int problemsBefore = problems;
+	int length = 3;		// Until byte 1 tells the console how long the packet is
+	int i;
+
+	setAttention(0);
+	for (i = 0; i < length && i < 32; i++){
+		uint8_t acked;
+		uint8_t out = i < commandLength ? command[i] : 0x00;
+		received[i] = exchangeByte(out, &acked);
+		// The low 4 bits of the mode are how many 16 bit words of data there are
+		if (i == 1)
+			length = 3 + 2 * (received[1] & 0x0F);
+		if (packet->updateAfterByte == i)
+			sendPS2DataWithPressures(secondData, secondPressures);
+
+		if (verbose)
+			printf("    %2d  %02X -> %02X", i, out, received[i]);
+		if (i < expectedLength && received[i] != expected[i]){
+			if (verbose)
+				printf("  expected %02X", expected[i]);
+			else
+				printf("    byte %d: sent %02X, expected %02X\n", i, received[i], expected[i]);
+			problems++;
+		}
+		if (!acked){
+			if (verbose)
+				printf("  no ACK\n");
+			break;
+		}
+		if (verbose)
+			printf("  ACK\n");
+	}
+	setAttention(1);
+
+	// The console stops at the first byte without an ACK, so that
+	//  should be the last byte we expected
+	int exchanged = i < length ? i + 1 : i;
+	if (exchanged != expectedLength){
+		printf("    exchanged %d bytes, expected %d\n", exchanged, expectedLength);
+		problems++;
+	}
+	if (i == length){
+		printf("    ACKed the last byte\n");
+		problems++;
+	}
+	printf("%-24s %2d bytes  %s\n", packet->name, exchanged,
+	       problems == problemsBefore ? "ok" : "PROBLEMS ABOVE");
+	return problems - problemsBefore;
+}
+
+void setUpControllerData(void){
+	memset(&firstData, 0, sizeof(firstData));
+	memset(&secondData, 0, sizeof(secondData));
+	memset(firstPressures, 0, sizeof(firstPressures));
+	memset(secondPressures, 0, sizeof(secondPressures));
+
+	// Start, up, cross and L2 held, with L2 a quarter of the way down
+	firstData.startOn = 1;
+	firstData.dpadUpOn = 1;
+	firstData.crossOn = 1;
+	firstData.l2On = 1;
+	firstPressures[10] = 0x40;
+	firstData.rightStickX = 0x30;
+	firstData.rightStickY = 0x40;
+	firstData.leftStickX = 0x10;
+	firstData.leftStickY = 0x20;
+
+	// Then circle half way down and R1, with the sticks centered
+	secondData.circleOn = 1;
+	secondData.r1On = 1;
+	secondPressures[5] = 0x7F;
+	secondData.rightStickX = 0x80;
+	secondData.rightStickY = 0x80;
+	secondData.leftStickX = 0x80;
+	secondData.leftStickY = 0x80;
+}
+
+int main(int argc, char** argv){
+	int option;
+	while ((option = getopt(argc, argv, "v")) != -1){
+		switch (option){
+		case 'v': verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	SPDR.onWrite = watchSPDR;
+	SPI_ACK_PORT.onWrite = watchACK;
+	PINB.value = (1<<ATT);		// Attention starts high
+
+	startPS2Communication();
+	setUpControllerData();
+	sendPS2DataWithPressures(firstData, firstPressures);
+	nextOut = SPDR.value;
+
+	int packets = sizeof(script) / sizeof(script[0]);
+	for (int i = 0; i < packets; i++)
+		runPacket(&script[i]);
+
+	printf("\n%d packets, %d bytes, %d problems\n", packets, bytesExchanged, problems);
+	return problems ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+#!/bin/bash
+# checkAckTiming.sh
+#
+# PS2ConsoleEmulator can't tell how long the SPI interrupt takes on the
+#  AVR, so this counts it from the compiled code instead.  It builds
+#  PS2interface.c with avr-gcc, the same way the firmware does, and goes
+#  through the disassembly of SPI_STC_vect, trying every way through it,
+#  and adds up the cycles of the slowest one to where we pull ACK low.
+#  If that's over the budget, it fails.
+#
+# To use it (you need avr-gcc and avr-objdump):
+#     ./checkAckTiming.sh          (the budget is 150 cycles)
+#     ./checkAckTiming.sh 200      (or set your own)
+#     ./checkAckTiming.sh -v       (and print the disassembly it counted)
+# MCU and F_CPU can be set in the environment, and default to the
+#  DoubleJoy firmware's, atmega8u2 at 16 MHz.
+# It exits with 0 if the interrupt fits, 1 if it doesn't, and 2 if it
+#  couldn't count it (no compiler, a loop, a call out of the interrupt,
+#  or an instruction it doesn't know the timing of).
+#
+# The console gives up on a byte if ACK doesn't come within about 100 us.
+#  150 cycles is 9 us at 16 MHz and 75 us at 2 MHz, and it leaves room
+#  for the roughly 100 cycles counted by hand in PS2interface.c - so
+#  going over it means that count is out of date, not that a console
+#  would already be giving up.
+
+BUDGET=150
+VERBOSE=0
+for arg in "$@"; do
+	if [ "$arg" = "-v" ]; then
+		VERBOSE=1
+	else
+		BUDGET=$arg
+	fi
+done
+MCU=${MCU:-atmega8u2}
+F_CPU=${F_CPU:-16000000UL}
+
+# The interrupt response, and the jmp in the vector table
+ENTRY_CYCLES=8
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PS2DIR=$(dirname "$HERE")
+
+for tool in avr-gcc avr-objdump; do
+	if ! command -v $tool > /dev/null; then
+		echo "$tool isn't installed, so we can't count the interrupt."
+		exit 2
+	fi
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Build it like the firmware does
+if ! avr-gcc -mmcu=$MCU -DF_CPU=$F_CPU -Os -funsigned-char -funsigned-bitfields \
+		-fpack-struct -fshort-enums -I"$PS2DIR" -c "$PS2DIR/PS2interface.c" -o "$WORK/PS2interface.o"; then
+	echo "PS2interface.c didn't build."
+	exit 2
+fi
+
+# Which vector SPI_STC_vect is, and where the ACK pin is
+DEFINES=$(echo '#include <avr/io.h>' | avr-gcc -mmcu=$MCU -E -dM -)
+VECTOR=$(echo "$DEFINES" | sed -n 's/^#define SPI_STC_vect _VECTOR(\([0-9]*\)).*/\1/p')
+ACK_PORT=$(sed -n 's/^#define SPI_ACK_PORT[[:space:]]*\([A-Z0-9]*\).*/\1/p' "$PS2DIR/PS2interface.h")
+ACK_BIT=$(sed -n 's/^#define ACK[[:space:]]*\([0-9]*\).*/\1/p' "$PS2DIR/PS2interface.h")
+ACK_ADDRESS=$(echo "$DEFINES" | sed -n "s/^#define $ACK_PORT _SFR_IO8(\(0x[0-9A-Fa-f]*\)).*/\1/p")
+if [ -z "$VECTOR" ] || [ -z "$ACK_ADDRESS" ] || [ -z "$ACK_BIT" ]; then
+	echo "Couldn't find SPI_STC_vect or the ACK pin for $MCU."
+	exit 2
+fi
+
+avr-objdump -d -r "$WORK/PS2interface.o" > "$WORK/PS2interface.lss"
+if [ $VERBOSE = 1 ]; then
+	sed -n "/<__vector_$VECTOR>:/,/^$/p" "$WORK/PS2interface.lss"
+fi
+
+sed -n "/<__vector_$VECTOR>:/,/^$/p" "$WORK/PS2interface.lss" | awk \
+		-v entry=$ENTRY_CYCLES -v budget=$BUDGET -v fcpu=${F_CPU%UL} \
+		-v ackAddress=$((ACK_ADDRESS)) -v ackBit=$ACK_BIT -v vector=$VECTOR '
+	function fail(why){
+		print "Can'\''t count SPI_STC_vect: " why
+		failed = 1
+		exit 2
+	}
+	# How many cycles each instruction takes on the AVR core in the 8u2.
+	#  Branches and skips depend on which way they go, so those are
+	#  worked out in slowest() instead.
+	function cycles(m){
+		if (m ~ /^(ld|ldd|lds|st|std|sts|push|pop|adiw|sbiw|sbi|cbi|rjmp|mul|muls|mulsu|fmul|fmuls|fmulsu)$/)
+			return 2
+		if (m ~ /^(lpm|jmp)$/)
+			return 3
+		if (m ~ /^(ret|reti)$/)
+			return 4
+		if (m ~ /^(mov|movw|ldi|ser|clr|in|out|add|adc|sub|subi|sbc|sbci|and|andi|or|ori|eor|com|neg|inc|dec|tst|cp|cpc|cpi|lsl|lsr|rol|ror|asr|swap|bst|bld|sbr|cbr|sec|clc|sen|cln|sez|clz|sei|cli|ses|cls|sev|clv|set|clt|seh|clh|nop|wdr)$/)
+			return 1
+		fail("no timing for " m)
+	}
+	# The slowest way from instruction i to pulling ACK low, counting
+	#  the cycles of everything up to and including that, or -1 if
+	#  there is no way to ACK from here
+	function slowest(i,    m, best, after, skipped){
+		if (i in done)
+			return done[i]
+		if (i in visiting)
+			fail("it has a loop at 0x" sprintf("%x", address[i]))
+		if (!(i in mnemonic))
+			fail("it runs off the end at 0x" sprintf("%x", i))
+		visiting[i] = 1
+		m = mnemonic[i]
+		after = i + size[i]
+		if (m == "cbi" && operands[i] ~ "^0x0*" sprintf("%x", ackAddress) ", " ackBit "$")
+			best = 2
+		else if (m == "ret" || m == "reti")
+			best = -1
+		else if (m ~ /^(call|rcall|icall|ijmp|eijmp|eicall)$/)
+			fail(m " at 0x" sprintf("%x", address[i]) " - count that by hand")
+		else if (m ~ /^br/)
+			best = longer(1, slowest(after), 2, slowest(target[i]))
+		else if (m ~ /^(cpse|sbrc|sbrs|sbic|sbis)$/){
+			skipped = after + size[after]
+			best = longer(1, slowest(after), 1 + size[after] / 2, slowest(skipped))
+		}
+		else if (m == "rjmp" || m == "jmp")
+			best = add(cycles(m), slowest(target[i]))
+		else
+			best = add(cycles(m), slowest(after))
+		delete visiting[i]
+		done[i] = best
+		return best
+	}
+	# awk only reads decimal, so this reads the hex addresses in the listing
+	function hex(text,    value, i){
+		sub(/^ *(0x)?/, "", text)
+		value = 0
+		for (i = 1; i <= length(text); i++)
+			value = value * 16 + index("0123456789abcdef", substr(text, i, 1)) - 1
+		return value
+	}
+	function add(c, rest){
+		return rest < 0 ? -1 : c + rest
+	}
+	function longer(c1, rest1, c2, rest2){
+		rest1 = add(c1, rest1)
+		rest2 = add(c2, rest2)
+		return rest1 > rest2 ? rest1 : rest2
+	}
+	# The function header, like 00000046 <__vector_20>:
+	/^[0-9a-f]+ </ {
+		start = hex($1)
+		next
+	}
+	# A relocation, which the linker fills in.  For a jump, that
+	#  is where it goes, and it has to stay inside the interrupt.
+	/R_AVR_/ {
+		sym = $NF
+		if (lastMnemonic !~ /^(br|rjmp|jmp|call|rcall)/)
+			next
+		if (sym ~ /^\.text\+0x/)
+			target[last] = hex(substr(sym, 7))
+		else if (sym ~ "^__vector_" vector "\\+0x")
+			target[last] = start + hex(substr(sym, index(sym, "+") + 1))
+		else if (sym == "__vector_" vector)
+			target[last] = start
+		else if (lastMnemonic ~ /call/)
+			fail(lastMnemonic " to " sym " - count that by hand")
+		else
+			fail(lastMnemonic " out to " sym)
+		next
+	}
+	# An instruction, like   4a:	19 f4       	brne	.+6
+	/^ +[0-9a-f]+:\t/ {
+		split($0, field, "\t")
+		a = hex(substr(field[1], 1, length(field[1]) - 1))
+		bytes = field[2]
+		gsub(/ /, "", bytes)
+		address[a] = a
+		size[a] = length(bytes) / 2
+		mnemonic[a] = field[3]
+		sub(/ +$/, "", mnemonic[a])
+		ops = field[4]
+		sub(/[ \t]*;.*/, "", ops)
+		sub(/ +$/, "", ops)
+		operands[a] = ops
+		if (ops ~ /^\.[+-][0-9]+$/)
+			target[a] = a + 2 + substr(ops, 2)
+		else if (ops ~ /^0x[0-9a-f]+$/ && mnemonic[a] ~ /^(jmp|call)$/)
+			target[a] = hex(ops)
+		last = a
+		lastMnemonic = mnemonic[a]
+	}
+	END {
+		if (failed)
+			exit 2
+		if (!(start in mnemonic)){
+			print "Couldn'\''t find SPI_STC_vect in the listing."
+			exit 2
+		}
+		total = slowest(start)
+		if (total < 0){
+			print "Couldn'\''t find where SPI_STC_vect pulls ACK low."
+			exit 2
+		}
+		total += entry
+		printf "SPI_STC_vect takes at most %d cycles to ACK (%.1f us at %d MHz), the budget is %d\n", \
+			total, total * 1000000 / fcpu, fcpu / 1000000, budget
+		if (total > budget){
+			print "That'\''s over budget - check the note above SPI_STC_vect."
+			exit 1
+		}
+	}'
@@ -0,0 +1,15 @@
+/*  hostAVR/avr/interrupt.h
+ *
+ *  On the PC, an interrupt handler is just a function the emulator
+ *   calls when the event it's waiting for happens, and there's nothing
+ *   to turn on or off.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void)
+#define sei()
+#define cli()
+
+#endif
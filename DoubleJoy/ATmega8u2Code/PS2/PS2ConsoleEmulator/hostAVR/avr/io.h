@@ -0,0 +1,50 @@
+/*  hostAVR/avr/io.h
+ *
+ *  Stand-ins for the AVR registers PS2interface.c uses, so that
+ *   PS2ConsoleEmulator can build it on a PC.  Each register is just a
+ *   byte, but it can tell the emulator whenever the library writes to it,
+ *   which is how we see SPDR being loaded and the ACK line being pulsed.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+class HostRegister
+{
+public:
+	uint8_t value;
+	// Called after every write, with the value from before it
+	void (*onWrite)(HostRegister* reg, uint8_t oldValue);
+
+	operator uint8_t() const { return value; }
+	HostRegister& operator=(uint8_t newValue){ write(newValue); return *this; }
+	HostRegister& operator|=(uint8_t bits){ write(value | bits); return *this; }
+	HostRegister& operator&=(uint8_t bits){ write(value & bits); return *this; }
+
+private:
+	void write(uint8_t newValue){
+		uint8_t oldValue = value;
+		value = newValue;
+		if (onWrite)
+			onWrite(this, oldValue);
+	}
+};
+
+extern HostRegister SPDR, SPCR, SREG;
+extern HostRegister PORTB, DDRB, PINB, PORTC, DDRC, PINC, PIND;
+extern HostRegister PCMSK0, PCICR;
+
+// SPCR bits
+#define SPIE 7
+#define SPE  6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+
+// PCICR bits
+#define PCIE0 0
+
+#endif
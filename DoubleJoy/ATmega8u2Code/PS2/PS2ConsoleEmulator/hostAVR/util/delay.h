@@ -0,0 +1,12 @@
+/*  hostAVR/util/delay.h
+ *
+ *  The emulator keeps its own time, so delays don't need to do anything.
+ */
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
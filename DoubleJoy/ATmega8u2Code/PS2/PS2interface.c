@@ -33,35 +33,40 @@ along with this.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 #include "PS2interface.h"
 
 /***GLOBAL CONSTANTS & VARIABLES***/
 
 unsigned char dataIn;			// data from PSX
-int8_t frameCounter;			// keeps track of bytes tranceived per packet
+uint8_t frameCounter;			// keeps track of bytes tranceived per packet
+uint8_t ps2State;				// which step of a packet exchange we're on
 unsigned char packetCode;       // keeps track of which type of packet we're sending
 unsigned char packetLength;		// keeps track of number of bytes to be exchanged in each packet
 unsigned char controllerDataPacketLength; // keeps track of the bytes to send in a controller data packet
 unsigned char controllerMode;	// keeps track of configured mode of controller
-char x46Switch;		   			// Used for the 0x46 code thing - there's a 2 packet constant 
-								//  response that gets sent in response to an incoming
-								//  0x46 packet code, so this tracks which response to send
-char x4CSwitch;					// Similar to above
 int8_t config;					// 0 = not in configuration mode,   1 = configuration mode
-char packetData[21];			// Stores the packet's data - not all will be used 
-char vibrationData[21];         // This isn't used right now, since we don't support vibration motor
+uint8_t packetData[21];			// Stores the start of each packet - not all will be used 
+uint8_t vibrationData[21];         // This isn't used right now, since we don't support vibration motor
                                 //  feedback yet
 
-// I don't think any of this buffering stuff is used right now....
-// Set of buffers for reading in button data
-//  since this code is interrupt driven
-char packetBuffer0[21] = {0xFF, 0x79, 0x5A, 0x11, 0xA5, 0x7F, 0x7F, 0x7F, 0x7F, 
+// Set of buffers for the controller data, since this code is interrupt driven.
+//  sendPS2Data() fills in one while the interrupt sends the other, and
+//  they only get swapped between packets, so the console never gets
+//  half of one update and half of the next.
+uint8_t packetBuffer0[21] = {0xFF, 0x79, 0x5A, 0xFF, 0xFF, 0x7F, 0x7F, 0x7F, 0x7F, 
 															 0,0,0,0,0,0,0,0,0,0,0,0};		
-char packetBuffer1[21] = {0xFF, 0x79, 0x5A, 0x11, 0xA5, 0x7F, 0x7F, 0x7F, 0x7F, 
+uint8_t packetBuffer1[21] = {0xFF, 0x79, 0x5A, 0xFF, 0xFF, 0x7F, 0x7F, 0x7F, 0x7F, 
 															 0,0,0,0,0,0,0,0,0,0,0,0};		
-char * currentInputBuffer;		// Pointer to hold the location of the current buffer
-								//  that we're writing to.  We will read the opposite buffer
+uint8_t * volatile currentInputBuffer;		// Pointer to hold the location of the current buffer
+										//  that we're writing to.
+uint8_t * volatile currentOutputBuffer;	// And the one the interrupt is sending from
+volatile uint8_t bufferSwapPending;		// Set when the input buffer is ready to send,
+										//  but a packet was going on so we couldn't swap yet
+uint8_t * sendBuffer;				// Where the rest of the packet we're sending comes from -
+								//  packetData or currentOutputBuffer
+const uint8_t * replyTable;		// Or the config reply in PROGMEM we're sending, if it's not 0
 
 // Constants that are used to identify certain packet types
 #define DIGITAL_MODE 				0x41
@@ -73,9 +78,15 @@ char * currentInputBuffer;		// Pointer to hold the location of the current buffe
 #define CONFIG_MODE					0xF3
 #define CONFIG_PACKET_LENGTH		9
 
+// The steps of a packet exchange.  We move along these one byte at a time.
+#define PS2_WAIT_START		0	// Waiting for the 0x01 that starts a packet for us
+#define PS2_WAIT_COMMAND	1	// Waiting for the command byte
+#define PS2_SEND_DATA		2	// Sending out the rest of the packet
+#define PS2_IGNORE			3	// Not talking until Attention goes high again
+
 /*******FUNCTIONS*******/
 
-void setPacketData(char source[])
+void setPacketData(uint8_t source[])
 {
 	packetData[0] = 0xFF;
 	packetData[1] = source[1];
@@ -88,7 +99,7 @@ void setPacketData(char source[])
 	packetData[8] = source[8];
 }
 
-void setVibrationData(char source[])
+void setVibrationData(uint8_t source[])
 {
 	vibrationData[0] = 0xFF;
 	vibrationData[1] = source[1];
@@ -102,7 +113,7 @@ void setVibrationData(char source[])
 }
 
 // Testing packet
-char packetDataTest[21] = {0xFF, 0x79, 0x5A, 0x11, 0xA5, 0x7F, 0x7F, 0x7F, 0x7F, 
+uint8_t packetDataTest[21] = {0xFF, 0x79, 0x5A, 0x11, 0xA5, 0x7F, 0x7F, 0x7F, 0x7F, 
 															 0,0,0,0,0,0,0,0,0,0,0,0};
 // Initialize all ports, pins, and variables.
 void startPS2Communication(void)
@@ -127,159 +138,96 @@ void startPS2Communication(void)
 	SPCR &= ~(1<<MSTR);			// select SLAVE mode
 	SPCR |= (1<<DORD);			// data order to LSB first
 	SPCR |= (1<<SPE);			// SPI enable
+	SPCR |= (1<<SPIE);			// interrupt after every byte
 
 	SPDR = 0xFF;				// initialize SPI Data Register to all bits HIGH
 
 	dataIn= 0x00;
 	frameCounter = 0;
-	x46Switch = 0;
-	x4CSwitch = 0;
+	ps2State = PS2_WAIT_START;
 	packetCode = 0x00;         // keeps track of which type of packet we're sending
 	controllerDataPacketLength = FULL_ANALOG_PACKET_LENGTH;//18;
 	packetLength = controllerDataPacketLength;
 	controllerMode = FULL_ANALOG_MODE;
 	config = 0;
+	currentInputBuffer = packetBuffer0;
+	currentOutputBuffer = packetBuffer1;
+	bufferSwapPending = 0;
+	sendBuffer = packetData;
+	replyTable = 0;
 	//Set up a default digital controller packet 
-	char packetDataInit[21] = {0xFF, controllerMode, 0x5A, PIND, PINC, 0x7F, 0x7F, 0x7F, 0x7F, 
+	uint8_t packetDataInit[21] = {0xFF, controllerMode, 0x5A, PIND, PINC, 0x7F, 0x7F, 0x7F, 0x7F, 
 															 0,0,0,0,0,0,0,0,0,0,0,0};
 	setPacketData(packetDataInit);
-	char vibrationDataInit[21] = {0xFF, 0xF3, 0x5A, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
+	uint8_t vibrationDataInit[21] = {0xFF, 0xF3, 0x5A, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
 						 	0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 	setVibrationData(vibrationDataInit);
 
 	// Finally, enable the interrupts to start PS2 communication
 	PCMSK0 = 1; // Enable pin change 0 interrupt
 	PCICR |= 1 << PCIE0;
-	sei();	// Enable global interrupts - we're using the Pin Change 0 interrupt
+	sei();	// Enable global interrupts - we're using the Pin Change 0 and SPI interrupts
 }
 
 
 
-char SPI_SlaveReceive(void)
+// The replies to the config commands, indexed by where we are in the packet.
+//  Bytes 0 - 2 are always the same, and only here so the indexes line up -
+//  the interrupt sends the mode and 0x5A from packetData.
+static const uint8_t PROGMEM replyZeros[9] = {0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+// 0x41 finds out what buttons are included in the polling response
+//  In digital mode, it gets replyZeros instead
+static const uint8_t PROGMEM reply41[9] = {0xFF, 0xF3, 0x5A, 0xFF, 0xFF, 0x03, 0x00, 0x00, 0x5A};
+// 0x45 is asking the controller for information about itself
+static const uint8_t PROGMEM reply45[9] = {0xFF, 0xF3, 0x5A, 0x03, 0x02, 0x01, 0x02, 0x01, 0x00};
+// 0x46 and 0x4C  Random checksum return thingies...
+//  There's a reply for an argument of 0, then one for 1 - see commandArgument()
+static const uint8_t PROGMEM reply46[2][9] = {{0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0A},
+                                              {0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x14}};
+static const uint8_t PROGMEM reply4C[2][9] = {{0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00},
+                                              {0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00}};
+// Another constant packet
+static const uint8_t PROGMEM reply47[9] = {0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00};
+// 0x4D  Maps bytes in the 0x42 command to activate vibration motors
+//   TODO: MAKE THIS STORE THE VALUE WRITTEN TO IT TO REPEAT LATER
+static const uint8_t PROGMEM reply4D[9] = {0xFF, 0xF3, 0x5A, 0x00, 0x01, 0xFF, 0xFF, 0xFF, 0xFF};
+// 0x4F  Adds and removes
+//   TODO: MAKE THIS STORE THE VALUE WRITTEN TO IT TO REPEAT LATER
+//    in conjunction with 0x41
+static const uint8_t PROGMEM reply4F[9] = {0xFF, 0xF3, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5A};
+
+// Which reply goes with each command from 0x40 to 0x4F.
+//  0x42, the normal poll, sends the controller data instead, and
+//  0x43 and 0x44 just get zeros back, like anything else we don't know.
+static const uint8_t * const PROGMEM commandReplies[16] = {
+	replyZeros, reply41, replyZeros, replyZeros,			// 0x40 - 0x43
+	replyZeros, reply45, reply46[0], reply47,				// 0x44 - 0x47
+	replyZeros, replyZeros, replyZeros, replyZeros,			// 0x48 - 0x4B
+	reply4C[0], reply4D, replyZeros, reply4F				// 0x4C - 0x4F
+};
+
+// Finds the reply table for a command, once we know what it is
+static const uint8_t * replyForCommand(unsigned char code)
 {
-	while(!(SPSR & (1<<SPIF)))
-	{
-		if (SPI_PIN & (1 << ATT)){  // If ATT (SS) is held high, just return
-			SPDR = 0x00;
-			frameCounter = 0;
-			return 0;
-		}
-	}		// wait for reception complete
-	return SPDR;					// return value in SPI data register
+	if ((code & 0xF0) != 0x40 || (code == 0x41 && controllerMode == DIGITAL_MODE))
+		return replyZeros;
+	return (const uint8_t *)pgm_read_word(&commandReplies[code & 0x0F]);
 }
 
-// This waits for the SPI unit to receive data, and returns 1 when the SPI
-//  unit receives data.
-// If, while waiting for data, SS goes high, then this function returns 0;
-// After using this function, read SPDR for the actual data
-char spiSlaveHasData(void)
+// Handles the byte that comes in alongside byte 3 of our reply,
+//  which is where the console tells us the argument to a command
+static void commandArgument(unsigned char code, unsigned char argument)
 {
-	while(!(SPSR & (1<<SPIF)))
-	{
-		if (PINB & (1 << ATT)){  // If ATT (SS) is held high, just return
-			SPDR = 0x00;
-			frameCounter = 0;
-			return 0;
-		}
-	}		// wait for reception complete
-	return 1;					// return value in SPI data register
-}
-
-// This sends one byte, followed by an ACK
-void sendOneByteSPI(void){
-	SPI_ACK_PORT &= ~(1<<ACK);					// ACK LOW
-	frameCounter++;						
-	SPDR = packetData[frameCounter];	// set SPDR to return the next byte in the frame
-										//  the next time the master communicates
-	SPI_ACK_PORT |= (1<<ACK);					// ACK back to HIGH
-}
-// Sends one byte, but no acknowledge, signifiying the end of a packet
-void sendOneByteSPINoACK(void){
-	frameCounter++;						
-	SPDR = packetData[frameCounter];	// set SPDR to return the next byte in the frame
-										//  the next time the master communicates
-}
-
-
-// This function reads in a byte of data and sets up the appropriate byte to be sent
-//  in return.  It's kinda hard to follow, but remember - it only actually sends one
-//  byte each time it's called. 
-void communicate(void)
-{
-
-	dataIn = SPI_SlaveReceive();	// read incoming byte from PS
-
-	// Check to see if we're even being talked to
-	if (SPI_PIN & (1 << ATT))  // If ATT (SS) is held high, just return
-	{
-		SPDR = 0x00;
-		frameCounter = 0;
-		return;
-	}
-	
-	// Now that we're being talked to...
-
-	if(frameCounter == 0)		// start command, always 0x01
-	{
-		// Read the buttons every start
-		// Figure out what sort of packet we'll be sending
-		if (dataIn == 0x01){
-			if (config == 1){
-				packetData[1] = CONFIG_MODE;	// Send the config mode code if appropriate
-				packetLength = CONFIG_PACKET_LENGTH;
-			}
-			else{
-				packetData[1] = controllerMode;		// set SPDR to return controller mode configuration
-				packetLength = controllerDataPacketLength;
-			}
-			sendOneByteSPI();
-		}
-		else // if we didn't get a 0x01, reset our logic
-			frameCounter = 0;
-	}
-	//  The second command will be the main command. We'll be returning
-	//   the controller type in this command, in sendOneByteSPI()
-	else if(frameCounter == 1)	// find out what buttons are included in poll responses				
-	{
-		packetCode = dataIn;
-		sendOneByteSPI();
-	}
-	// 0x41 finds out what buttons are included in the polling response
-	else if( (frameCounter == 2) && (packetCode == 0x41)){
-		if (controllerMode == DIGITAL_MODE){
-			packetData[3] = 0x00;
-			packetData[4] = 0x00;
-			packetData[5] = 0x00;
-			packetData[6] = 0x00;
-			packetData[7] = 0x00;
-			packetData[8] = 0x00;
-		}
-		else{
-			packetData[3] = 0xFF;
-			packetData[4] = 0xFF;
-			packetData[5] = 0x03;
-			packetData[6] = 0x00;
-			packetData[7] = 0x00;
-			packetData[8] = 0x5A;
-		}
-		sendOneByteSPI();
-	}
+	switch (code){
 	// 0x43 This handles entering and exiting config mode
-	else if( (frameCounter == 3) && (packetCode == 0x43) ){
-		if (dataIn == 0x01){
-			config = 1;
-		}
-		else{
-			config = 0;
-		}
-		sendOneByteSPI();
-	}
+	case 0x43:
+		config = (argument == 0x01);
+		break;
 	// 0x44  This changes modes between digital and analog mode.
 	//  Depending on which mode, we change the length of the controller data packets
 	//  and set things up to tell the system what sort of data to expect
-	else if( (frameCounter == 3) && (packetCode == 0x44)){// && (config == 1) ){
-		sendOneByteSPI();
-		if (dataIn == 0x00 && (1 == 2)){
+	case 0x44:
+		if (argument == 0x00 && (1 == 2)){
 			controllerMode = DIGITAL_MODE;
 			controllerDataPacketLength = DIGITAL_PACKET_LENGTH;
 		}
@@ -287,142 +235,149 @@ void communicate(void)
 			controllerMode = FULL_ANALOG_MODE;
 			controllerDataPacketLength = FULL_ANALOG_PACKET_LENGTH;
 		}
+		break;
+	// Continued 0x46 and 0x4C stuff - byte 3 is 0x00 either way, so we've
+	//  already sent it, and we just switch to the other reply for the rest
+	case 0x46:
+	case 0x4C:
+		if (argument == 0x01)
+			replyTable += 9;
+		break;
 	}
-	// 0x45 is asking the controller for information about itself
-	else if( (frameCounter == 2) && (packetCode == 0x45)){// && (config == 1) ){
-		packetData[3] = 0x03;
-		packetData[4] = 0x02;
-		packetData[5] = 0x01;
-		packetData[6] = 0x02;
-		packetData[7] = 0x01;
-		packetData[8] = 0x00;
-		sendOneByteSPI();
-	}
-	// 0x46  Random checksum return thingy...
-	else if( (frameCounter == 2) && (packetCode == 0x46)){// && (config == 1) ){
-		packetData[3] = 0x00;
-		sendOneByteSPI();
-	}
-	// Continued 0x46 stuff
-	else if( (frameCounter == 3) && (packetCode == 0x46)){// && (config == 1) ){
-		if (dataIn == 0x00){
-			packetData[4] = 0x00;
-			packetData[5] = 0x00;
-			packetData[6] = 0x02;
-			packetData[7] = 0x00;
-			packetData[8] = 0x0A;
+}
+
+// This gets called every time the SPI unit finishes swapping a byte with
+//  the console.  It reads the byte that came in, steps the state machine
+//  along by one, and loads up the next byte to send, so we only spend a
+//  few microseconds in here per byte, instead of sitting in an interrupt
+//  for the whole packet.  The console waits for our ACK before it sends
+//  the next byte, so there's always time to get SPDR ready.
+// The console gives up on a byte if ACK doesn't come within about 100 us.
+//  Counted by hand from the C, the longest path to ACK is byte 3 of a 0x46
+//  or 0x4C packet with an argument of 1: about 30 cycles to get into the
+//  interrupt and save registers, and about 65 more to step along, move
+//  the reply table and load SPDR from PROGMEM - roughly 100 cycles.  That's
+//  about 6 us at 16 MHz, or 50 us at 2 MHz, which still fits.  That's an
+//  estimate - PS2ConsoleEmulator/checkAckTiming.sh counts the real thing
+//  from the compiled code, and fails if it's over budget, so run it if you
+//  change this interrupt.  Remember the ACK also waits for any other
+//  interrupt (like the USB one) that's running when the byte comes in.
+ISR(SPI_STC_vect)
+{
+	dataIn = SPDR;
+
+	switch (ps2State){
+	// The first byte is always 0x01 if it's for us.  Anything else is
+	//  for something else on the bus, like a memory card, so we keep
+	//  quiet until Attention goes high again.
+	case PS2_WAIT_START:
+		if (dataIn != 0x01){
+			SPDR = 0xFF;
+			ps2State = PS2_IGNORE;
+			return;
 		}
-		if (dataIn == 0x01){
-			packetData[4] = 0x00;
-			packetData[5] = 0x00;
-			packetData[6] = 0x00;
-			packetData[7] = 0x00;
-			packetData[8] = 0x14;
+		sendBuffer = packetData;
+		replyTable = 0;
+		if (config == 1){
+			packetData[1] = CONFIG_MODE;	// Send the config mode code if appropriate
+			packetLength = CONFIG_PACKET_LENGTH;
 		}
-		sendOneByteSPI();
-	}
-	// Another constant packet
-	else if( (frameCounter == 2) && (packetCode == 0x47)){// && (config == 1) ){
-		packetData[3] = 0x00;
-		packetData[4] = 0x00;
-		packetData[5] = 0x02;
-		packetData[6] = 0x00;
-		packetData[7] = 0x00;
-		packetData[8] = 0x00;
-		sendOneByteSPI();
-	}
-	// 0x4C  Random checksum return thingy...
-	else if( (frameCounter == 2) && (packetCode == 0x4C)){// && (config == 1) ){
-		packetData[3] = 0x00;
-		sendOneByteSPI();
-	}
-	// Continued 0x4C stuff
-	else if( (frameCounter == 3) && (packetCode == 0x4C)){// && (config == 1) ){
-		if (dataIn == 0x00){
-			packetData[4] = 0x00;
-			packetData[5] = 0x00;
-			packetData[6] = 0x04;
-			packetData[7] = 0x00;
-			packetData[8] = 0x00;
+		else{
+			packetData[1] = controllerMode;		// return the controller mode configuration
+			packetLength = controllerDataPacketLength;
 		}
-		if (dataIn == 0x01){
-			packetData[4] = 0x00;
-			packetData[5] = 0x00;
-			packetData[6] = 0x06;
-			packetData[7] = 0x00;
-			packetData[8] = 0x00;
+		ps2State = PS2_WAIT_COMMAND;
+		break;
+	//  The second byte is the main command. We're sending the 0x5A
+	//   that always comes next while it arrives.
+	//  Polls, and the 0x43 that enters config mode, get answered with the
+	//   controller data, straight from the output buffer.  Nothing else
+	//   writes to that buffer until Attention goes high, so the whole
+	//   packet comes from the same update.
+	//  Everything else gets a reply table, which is only CONFIG_PACKET_LENGTH
+	//   long.  The console only sends those commands in config mode, where
+	//   that's the packet length anyway, but if one turns up in the middle
+	//   of a poll, we stop there instead of reading past the end of the table.
+	case PS2_WAIT_COMMAND:
+		packetCode = dataIn;
+		if (packetCode == 0x42 || (packetCode == 0x43 && config == 0))
+			sendBuffer = currentOutputBuffer;
+		else{
+			replyTable = replyForCommand(packetCode);
+			if (packetLength > CONFIG_PACKET_LENGTH)
+				packetLength = CONFIG_PACKET_LENGTH;
 		}
-		sendOneByteSPI();
-	}
-	// 0x4D  Maps bytes in the 0x42 command to activate vibration motors
-	//   TODO: MAKE THIS STORE THE VALUE WRITTEN TO IT TO REPEAT LATER
-	else if( (frameCounter == 2) && (packetCode == 0x4D)){// && (config == 1) ){
-		packetData[3] = 0x00;
-		packetData[4] = 0x01;
-		packetData[5] = 0xFF;
-		packetData[6] = 0xFF;
-		packetData[7] = 0xFF;
-		packetData[8] = 0xFF;
-		sendOneByteSPI();
-	}
-	// 0x4F  Adds and removes
-	//   TODO: MAKE THIS STORE THE VALUE WRITTEN TO IT TO REPEAT LATER
-	//    in conjunction with 0x41
-	else if( (frameCounter == 2) && (packetCode == 0x4F)){// && (config == 1) ){
-		packetData[3] = 0x00;
-		packetData[4] = 0x00;
-		packetData[5] = 0x00;
-		packetData[6] = 0x00;
-		packetData[7] = 0x00;
-		packetData[8] = 0x5A;
-		sendOneByteSPI();
+		ps2State = PS2_SEND_DATA;
+		break;
+	// Finally, just send out all the rest of the data
+	case PS2_SEND_DATA:
+		if (frameCounter == 3)
+			commandArgument(packetCode, dataIn);
+		break;
+	// Not for us, or we've sent everything.  If we don't load SPDR,
+	//  the SPI unit would send back whatever it just got, so hold the line high.
+	default:
+		SPDR = 0xFF;
+		return;
 	}
-	// Finally, just send out all the rest of the data if told to do so
-	else if(frameCounter > 1)
-	{
+
+	frameCounter++;
+	if (frameCounter < packetLength){
+		// set SPDR to return the next byte in the frame
+		//  the next time the master communicates
+		if (replyTable)
+			SPDR = pgm_read_byte(&replyTable[frameCounter]);
+		else
+			SPDR = sendBuffer[frameCounter];
 		// We send out an ACK signal for each byte but the last one
-		if(frameCounter < packetLength - 1)
-		{
-				frameCounter++;
-				unsigned char byteToSend = packetData[frameCounter]; // Read this here, otherwise it takes too long to send
-				SPI_ACK_PORT &= ~(1<<ACK);					// ACK LOW
-	
-				SPDR = byteToSend;//packetDataTest[frameCounter];	// set SPDR to return the next byte in the frame
-													//  the next time the master communicates
-				SPI_ACK_PORT |= (1<<ACK);					// ACK back to HIGH
-		}
-		else if (frameCounter == packetLength - 1)// this is for the last byte
-		{
-				frameCounter++;	
-				unsigned char byteToSend = packetData[frameCounter];
-				SPDR = byteToSend;	// set SPDR to return the next byte in the frame
-													//  the next time the master communicates
-				SPI_ACK_PORT |= (1<<ACK);					// ACK back to HIGH
-		}
-		// Finally, a little check to make sure we don't go out of bounds
-		else if(frameCounter >= packetLength){
-			frameCounter = 0;
-		}
+		SPI_ACK_PORT &= ~(1<<ACK);			// ACK LOW
+		SPI_ACK_PORT |= (1<<ACK);			// ACK back to HIGH
 	}
+	else{
+		SPDR = 0xFF;
+		ps2State = PS2_IGNORE;
+	}
+}
+
+// Swaps the input and output buffers.  Only call this between packets,
+//  with interrupts off.
+static inline void swapPacketBuffers(void)
+{
+	uint8_t * filled = currentInputBuffer;
+	currentInputBuffer = currentOutputBuffer;
+	currentOutputBuffer = filled;
+	bufferSwapPending = 0;
 }
 
-// This interrupt gets called every time Attention changes, and it sends a packet
+// This interrupt gets called every time Attention changes.  Either way,
+//  we're between packets, so it's a safe time to swap in new controller data,
+//  and we get ready for the start of a new packet.
 ISR(PCINT0_vect){
+	if (bufferSwapPending)
+		swapPacketBuffers();
 	frameCounter = 0;
+	ps2State = PS2_WAIT_START;
 	SPDR = 0xFF;
-	// While ATT is held low, we complete a full packet exhange.
-	while (!(SPI_PIN & (1 << ATT))){
-		// communicate() only handles one byte at a time, so we loop this
-		communicate();
-	}
 }
 
 // This is our external hook - someone else writes data to us,
-//  and we just throw it into the buffer to send since double-buffering
-//  is too slow (running at 2MHz).
+//  and we fill in the input buffer with it.  If the console isn't in the
+//  middle of a packet, it gets swapped in to send right away, otherwise
+//  the pin change interrupt swaps it in as soon as the packet ends.
 void sendPS2Data(dataForController_t controllerData){
+	sendPS2DataWithPressures(controllerData, 0);
+}
+
+// The same, with the button pressures that go in bytes 9 - 20
+//  of a full analog packet
+void sendPS2DataWithPressures(dataForController_t controllerData, const uint8_t* pressures){
+	// Stop the interrupt from swapping in the input buffer while we're writing it.
+	//  If it hasn't been swapped in yet, this new data replaces it anyway.
+	bufferSwapPending = 0;
+	uint8_t * buffer = currentInputBuffer;
+
 	// set the buttons - for the packet, 0 means pressed, 1 means off
-	packetData[3] = ( (!controllerData.selectOn) << 0 |
+	buffer[3] = ( (!controllerData.selectOn) << 0 |
 						 (!controllerData.l3On) << 1 |
 						 (!controllerData.r3On) << 2 |
 						 (!controllerData.startOn) << 3 |
@@ -431,7 +386,7 @@ void sendPS2Data(dataForController_t controllerData){
 						 (!controllerData.dpadDownOn) << 6 |
 						 (!controllerData.dpadLeftOn) << 7    );
 
-	packetData[4] = ( (!controllerData.l2On) << 0 |
+	buffer[4] = ( (!controllerData.l2On) << 0 |
 						 (!controllerData.r2On) << 1 |
 						 (!controllerData.l1On) << 2 |
 						 (!controllerData.r1On) << 3 |
@@ -440,10 +395,35 @@ void sendPS2Data(dataForController_t controllerData){
 						 (!controllerData.crossOn) << 6 |
 						 (!controllerData.squareOn) << 7    );
 
-	packetData[5] = controllerData.rightStickX;
-	packetData[6] = controllerData.rightStickY;
-	packetData[7] = controllerData.leftStickX;
-	packetData[8] = controllerData.leftStickY;
+	buffer[5] = controllerData.rightStickX;
+	buffer[6] = controllerData.rightStickY;
+	buffer[7] = controllerData.leftStickX;
+	buffer[8] = controllerData.leftStickY;
+
+	// Then the pressures, in the order the packet has them.  Buttons that
+	//  don't have one are either all the way down or not pressed at all.
+	uint8_t pressed[PS2_PRESSURE_COUNT] = {
+		controllerData.dpadRightOn, controllerData.dpadLeftOn,
+		controllerData.dpadUpOn, controllerData.dpadDownOn,
+		controllerData.triangleOn, controllerData.circleOn,
+		controllerData.crossOn, controllerData.squareOn,
+		controllerData.l1On, controllerData.r1On,
+		controllerData.l2On, controllerData.r2On };
+	for (uint8_t i = 0; i < PS2_PRESSURE_COUNT; i++){
+		if (pressures && pressures[i])
+			buffer[9 + i] = pressures[i];
+		else
+			buffer[9 + i] = pressed[i] ? 0xFF : 0x00;
+	}
+
+	// cli() also makes sure all of the writes above are done before we swap
+	uint8_t oldSREG = SREG;
+	cli();
+	if (SPI_PIN & (1<<ATT))		// Attention high - no packet going on
+		swapPacketBuffers();
+	else
+		bufferSwapPending = 1;
+	SREG = oldSREG;
 }
 
 // This code is only compiled if the LIBRARY_TEST_MAIN flag is
@@ -14,7 +14,8 @@ It uses all the SPI pins, plus one more
  pin for the PS2's non-standard ACK signal
  
 THIS CODE USES INTERRUPTS - specifically, it uses
- a pin change interrupt on the non-SPI 'Attention' line.
+ a pin change interrupt on the non-SPI 'Attention' line,
+ and the SPI interrupt, which handles one byte each time.
  Be aware of this.
 
 This code should work on a variety of AVR devices.
@@ -64,6 +65,10 @@ along with this.  If not, see <http://www.gnu.org/licenses/>.
 #define ACK		4		//Choose any pin you like
 
 
+// DoubleJoy.c doesn't use this library yet - the DoubleJoy firmware
+//  only talks to the PS3, over USB - so for now it's here for your own
+//  firmware, and for PS2ConsoleEmulator.
+
 // This function sets up the PS2 communication.
 //  Run it before your main loop, or at least before
 //  you try and send data.
@@ -73,10 +78,21 @@ void startPS2Communication(void);
 //  that tells the controller what signals to send.
 void sendPS2Data(dataForController_t);
 
+// This does the same, along with how hard each button is pressed,
+//  for the full analog (0x79) mode.  pressures holds PS2_PRESSURE_COUNT
+//  bytes, from 1 (barely pressed) to 255 (all the way down), in this order:
+//   dpad right, dpad left, dpad up, dpad down, triangle, circle, cross,
+//   square, l1, r1, l2, r2
+//  A 0 means that button doesn't have a pressure, so it reads as all the way
+//  down whenever it's pressed.  Pass 0 instead of an array if none of them do.
+#define PS2_PRESSURE_COUNT 12
+void sendPS2DataWithPressures(dataForController_t, const uint8_t* pressures);
+
 
 // Uncomment this, and a main() function will be included in
 //  this code, so you can compile the library as a stand-alone test
-//  application.
+//  application.  To try the library out without a console at all,
+//  see PS2ConsoleEmulator, which runs it on a PC.
 //#define LIBRARY_TEST_MAIN
 
 // These are used by the test main() function 
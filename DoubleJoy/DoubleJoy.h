@@ -10,6 +10,9 @@
  *   getBlankDataForController()
  *   setControllerData(dataForController_t dataToSet) - Sets data for controller 1
  *   setControllerData(byte controllerNumber, dataForController_t dataToSet) - Sets data for controller 1 or 2
+ *   setControllerData(byte controllerNumber, dataForController_t dataToSet, pressureForController_t pressures)
+ *      - The same, along with how hard each button is pressed
+ *   getBlankPressureForController()
  *
  *   NOTE: You cannot use pins 0 or 1 if you use this code - they are used by the serial communication.
  *         Also, the setupUnoJoy() function starts the serial port at 38400, so if you're using
@@ -51,6 +54,7 @@
 #define UNOJOY_H
     #include <stdint.h>
     #include <util/atomic.h>
+    #include <util/crc16.h>
     #include <Arduino.h>
 
     // This struct is the core of the library.
@@ -88,6 +92,32 @@
                                  // Important - analogRead(pin) returns a 10 bit value, so if you're getting strange
                                  //  results from analogRead, you may need to do (analogRead(pin) >> 2) to get good data
 	} dataForController_t;
+
+    // If your buttons can tell how hard they're pressed, you can send that too,
+    //  from 1 (barely pressed) to 255 (all the way down), with
+    //  setControllerData(whichController, yourData, yourPressures);
+    //  Leave the pressure at 0 for any button that's just on or off -
+    //  it'll read as all the way down whenever it's on.
+    //  Games that use pressure on the PS3 will see these, though the
+    //  PS3 doesn't have pressures for the d-pad.  The PS2 library in the
+    //  firmware's PS2 folder can send them too, but the DoubleJoy firmware
+    //  doesn't drive a PS2 yet, so for now they only go to the PS3.
+    //  Don't change this either - the order is the same as the PS2 uses.
+    typedef struct pressureForController_t
+    {
+        uint8_t dpadRightPressure;
+        uint8_t dpadLeftPressure;
+        uint8_t dpadUpPressure;
+        uint8_t dpadDownPressure;
+        uint8_t trianglePressure;
+        uint8_t circlePressure;
+        uint8_t crossPressure;
+        uint8_t squarePressure;
+        uint8_t l1Pressure;
+        uint8_t r1Pressure;
+        uint8_t l2Pressure;
+        uint8_t r2Pressure;
+    } pressureForController_t;
     
     // Call setupDoubleJoy in the setup block of your program.
     //  It sets up the hardware UnoJoy needs to work properly
@@ -100,6 +130,8 @@
     // signal until you tell it otherwise with this function.
     void setControllerData(byte, dataForController_t);
     void setControllerData(dataForController_t, byte); // Just so you don't have to remember the order
+    // And this does the same, along with the button pressures
+    void setControllerData(byte, dataForController_t, pressureForController_t);
     
     // This function gives you a quick way to get a fresh
     //  dataForController_t with:
@@ -109,6 +141,8 @@
     // It returns a dataForController_t, so you want to call it like:
     //    myControllerData = getBlankDataForController();
     dataForController_t getBlankDataForController(void);
+    // And this gives you a pressureForController_t with no pressures at all
+    pressureForController_t getBlankPressureForController(void);
     
     // You can also call the setup function with an integer argument
     //  declaring how often, in  milliseconds, the buffer should send its data 
@@ -130,26 +164,45 @@
 //----- End of the interface code you should be using -----//
 //----- Below here is the actual implementation of
     
-  // This dataForController_t is used to store
-  //  the controller data that you want to send
-  //  out to the controller.  You shouldn't mess
-  //  with this directly - call setControllerData instead
-  dataForController_t controllerDataBuffer1;
-  dataForController_t controllerDataBuffer2;
+  // The data for each controller lives in one of these buffers.
+  //  setControllerData fills in one the timer interrupt isn't using,
+  //  then publishes it by changing publishedBuffer for that controller.
+  //  That's a single byte, so the interrupt always sees a whole update,
+  //  and we never have to turn interrupts off.  There are three per
+  //  controller so that the firmware can still be reading an older one
+  //  a byte at a time (servingBuffer) while we fill in the next.
+  //  You shouldn't mess with these directly - call setControllerData instead
+  #define DOUBLEJOY_BUFFER_COUNT 3
+  dataForController_t controllerDataBuffers[2][DOUBLEJOY_BUFFER_COUNT];
+  pressureForController_t controllerPressureBuffers[2][DOUBLEJOY_BUFFER_COUNT];
+  volatile uint8_t publishedBuffer[2] = {0, 0};
+  volatile uint8_t servingBuffer[2] = {0, 0};
 
   // This updates the data that the controller is sending out.
   //  The system actually works as following:
-  //  The UnoJoy firmware on the ATmega8u2 regularly polls the
-  //  Arduino chip for individual bytes of a dataForController_t.
+  //  The DoubleJoy firmware on the ATmega8u2 regularly asks the
+  //  Arduino chip for both controllers' dataForController_t at once,
+  //  so both players' data always comes from the same moment.
+  void setControllerData(byte controllerNumber, dataForController_t controllerData,
+                         pressureForController_t pressures){
+    if (controllerNumber != 1 && controllerNumber != 2)
+      return;
+    uint8_t controller = controllerNumber - 1;
+    // Fill in a buffer that isn't published, and that the firmware
+    //  isn't reading.  servingBuffer can only change to publishedBuffer
+    //  behind our back, so this one stays free until we publish it.
+    uint8_t published = publishedBuffer[controller];
+    uint8_t serving = servingBuffer[controller];
+    uint8_t next = 0;
+    while (next == published || next == serving)
+      next++;
+    controllerDataBuffers[controller][next] = controllerData;
+    controllerPressureBuffers[controller][next] = pressures;
+    publishedBuffer[controller] = next;
+  }
+  // Without any pressures, every button is just on or off
   void setControllerData(byte controllerNumber, dataForController_t controllerData){
-    // Probably unecessary, but this guarantees that the data
-    //  gets copied to our buffer all at once.
-    ATOMIC_BLOCK(ATOMIC_FORCEON){
-      if (controllerNumber == 1)
-        controllerDataBuffer1 = controllerData;
-      else if (controllerNumber == 2)
-        controllerDataBuffer2 = controllerData;
-    }
+    setControllerData(controllerNumber, controllerData, getBlankPressureForController());
   }
   // This just lets you enter in the order in the other way with no problems
   void setControllerData(dataForController_t controllerData, byte controllerNumber){
@@ -158,11 +211,7 @@
   
   // And we maintain compatability with code written for UnoJoy
   void setControllerData(dataForController_t controllerData){
-    // Probably unecessary, but this guarantees that the data
-    //  gets copied to our buffer all at once.
-    ATOMIC_BLOCK(ATOMIC_FORCEON){
-      controllerDataBuffer1 = controllerData;
-    }
+    setControllerData(1, controllerData);
   }
   
   // serialCheckInterval governs how many ms between
@@ -182,8 +231,12 @@
   void setupDoubleJoy(void){ setupUnoJoy(); } //That was easy.
   void setupUnoJoy(void){
     // First, let's zero out our controller data buffer (center the sticks)
-    controllerDataBuffer1 = getBlankDataForController();
-    controllerDataBuffer2 = getBlankDataForController();
+    for (uint8_t controller = 0; controller < 2; controller++){
+      controllerDataBuffers[controller][0] = getBlankDataForController();
+      controllerPressureBuffers[controller][0] = getBlankPressureForController();
+      publishedBuffer[controller] = 0;
+      servingBuffer[controller] = 0;
+    }
   
     // Start the serial port at the specific, low-error rate UnoJoy uses.
     //  If you want to change the rate, you'll have to change it in the
@@ -210,6 +263,68 @@
     setupUnoJoy();
   }
   
+  // These are the codes used on the serial line between the Arduino
+  //  and the DoubleJoy firmware.  A request byte smaller than
+  //  2*sizeof(dataForController_t) asks for just that byte of the
+  //  two controllers' data.  DOUBLEJOY_SNAPSHOT_REQUEST asks for all of
+  //  it at once, which we send back as a frame:
+  //    DOUBLEJOY_FRAME_START, 2*sizeof(dataForController_t), controller 1's
+  //    data, controller 2's data, then a CRC-8 (Dallas/Maxim) of the
+  //    length and data bytes
+  //  DOUBLEJOY_PRESSURE_REQUEST asks for the same frame, with each
+  //  controller's data followed by its pressures: two bytes, low byte first,
+  //  with a bit set for each pressure that isn't 0, then just those pressures.
+  //  That way buttons without one don't cost any time on the serial line.
+  #define DOUBLEJOY_SNAPSHOT_REQUEST 0xF0
+  #define DOUBLEJOY_PRESSURE_REQUEST 0xF1
+  #define DOUBLEJOY_FRAME_START 0xA5
+  
+  // Sends some bytes of a frame, and returns the CRC with them added in
+  uint8_t sendFrameBytes(const uint8_t* bytes, uint8_t count, uint8_t crc){
+    for (uint8_t i = 0; i < count; i++)
+      crc = _crc_ibutton_update(crc, bytes[i]);
+    Serial.write(bytes, count);
+    return crc;
+  }
+  
+  // This sends out both controllers' published data as one frame,
+  //  with their pressures if withPressures isn't 0
+  void sendControllerDataFrame(uint8_t withPressures){
+    uint8_t* data[2];
+    uint8_t* pressures[2];
+    uint16_t pressuresSent[2] = {0, 0};
+    uint8_t length = 2*sizeof(dataForController_t);
+    for (uint8_t controller = 0; controller < 2; controller++){
+      uint8_t published = publishedBuffer[controller];
+      data[controller] = (uint8_t*)&controllerDataBuffers[controller][published];
+      pressures[controller] = (uint8_t*)&controllerPressureBuffers[controller][published];
+      if (withPressures){
+        length += 2;
+        for (uint8_t i = 0; i < sizeof(pressureForController_t); i++){
+          if (pressures[controller][i]){
+            pressuresSent[controller] |= 1 << i;
+            length++;
+          }
+        }
+      }
+    }
+    uint8_t crc = _crc_ibutton_update(0, length);
+    Serial.write(DOUBLEJOY_FRAME_START);
+    Serial.write(length);
+    for (uint8_t controller = 0; controller < 2; controller++){
+      crc = sendFrameBytes(data[controller], sizeof(dataForController_t), crc);
+      if (withPressures){
+        uint8_t sent[2] = {pressuresSent[controller] & 0xFF, pressuresSent[controller] >> 8};
+        crc = sendFrameBytes(sent, 2, crc);
+        for (uint8_t i = 0; i < sizeof(pressureForController_t); i++){
+          if (pressures[controller][i])
+            crc = sendFrameBytes(&pressures[controller][i], 1, crc);
+        }
+      }
+    }
+    Serial.write(crc);
+  }
+  
   // This interrupt gets called approximately once per ms.
   //  It counts how many ms between serial port polls,
   //  and if it's been long enough, polls the serial
@@ -224,13 +339,23 @@
         // Get incoming byte from the ATmega8u2
         byte inByte = Serial.read();
         // That number tells us which byte of which buffer
-        //  to send out.
-        if (inByte < 0)
-            return;
-        else if (inByte < sizeof(dataForController_t))
-            Serial.write(((uint8_t*)&controllerDataBuffer1)[inByte]);
-        else if (inByte < 2*sizeof(dataForController_t))
-            Serial.write(((uint8_t*)&controllerDataBuffer2)[inByte - sizeof(dataForController_t)]);
+        //  to send out, or that the firmware wants both of them.
+        if (inByte == DOUBLEJOY_SNAPSHOT_REQUEST)
+            sendControllerDataFrame(0);
+        else if (inByte == DOUBLEJOY_PRESSURE_REQUEST)
+            sendControllerDataFrame(1);
+        else if (inByte < 2*sizeof(dataForController_t)){
+            // The firmware asks for the bytes in order, so we hang on to
+            //  one buffer per controller from byte 0 on, and they all
+            //  come from one update of each
+            if (inByte == 0){
+                servingBuffer[0] = publishedBuffer[0];
+                servingBuffer[1] = publishedBuffer[1];
+            }
+            uint8_t controller = inByte / sizeof(dataForController_t);
+            uint8_t index = inByte % sizeof(dataForController_t);
+            Serial.write(((uint8_t*)&controllerDataBuffers[controller][servingBuffer[controller]])[index]);
+        }
       }
     }
   }
@@ -266,5 +391,13 @@
     // And return the data!
     return controllerData;
   }
+  
+  // Returns a pressureForController_t with every pressure at 0,
+  //  so all the buttons are just on or off
+  pressureForController_t getBlankPressureForController(void){
+    pressureForController_t pressures;
+    memset(&pressures, 0, sizeof(pressures));
+    return pressures;
+  }
 
 #endif
@@ -19,6 +19,7 @@
 #include "Platform.h"
 #include "USBAPI.h"
 #include "USBDesc.h"
+#include <stddef.h>
 
 #if defined(USBCON)
 #ifdef HID_ENABLED
@@ -601,6 +602,15 @@ void Joystick_::setControllerData(dataForController_t controllerData)
     set(controllerData);
 }
 
+// This turns the d-pad into a hat switch direction.  It's indexed by
+//  the d-pad bits as {left, up, right, down}, bit 0 first, and gives
+//  8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
+//  4 = down, 5 = down/left, 6 = left, 7 = left/up
+//  Up wins over down, and left wins over right.
+static const uint8_t _hatMap[16] PROGMEM = {
+    8, 6, 0, 7, 2, 6, 1, 7, 4, 5, 0, 7, 3, 5, 1, 7
+};
+
 void Joystick_::set(dataForController_t controllerData)
 {
     _joystickReport.triangle_btn = controllerData.triangleOn;
@@ -612,83 +622,30 @@ void Joystick_::set(dataForController_t controllerData)
     _joystickReport.l2_btn = controllerData.l2On;
     _joystickReport.r2_btn = controllerData.r2On;
 
-    if (_joystickReport.triangle_btn == 1)
-        _joystickReport.triangle_axis = 0xFF;
-    else
-        _joystickReport.triangle_axis = 0;
-        
-    if (_joystickReport.square_btn == 1)
-        _joystickReport.square_axis = 0xFF;
-    else
-        _joystickReport.square_axis = 0;
-
-    if (_joystickReport.cross_btn == 1)
-        _joystickReport.cross_axis = 0xFF;
-    else
-        _joystickReport.cross_axis = 0;
-
-    if (_joystickReport.circle_btn == 1)
-        _joystickReport.circle_axis = 0xFF;
-    else
-        _joystickReport.circle_axis = 0;
+    // We only have digital buttons, so the pressures are 0x00 or 0xFF.
+    //  0 - 1 is 0xFF, so negating the button bit gives us that.
+    _joystickReport.triangle_axis = -(uint8_t)controllerData.triangleOn;
+    _joystickReport.square_axis = -(uint8_t)controllerData.squareOn;
+    _joystickReport.cross_axis = -(uint8_t)controllerData.crossOn;
+    _joystickReport.circle_axis = -(uint8_t)controllerData.circleOn;
+    _joystickReport.l1_axis = -(uint8_t)controllerData.l1On;
+    _joystickReport.l2_axis = -(uint8_t)controllerData.l2On;
+    _joystickReport.r1_axis = -(uint8_t)controllerData.r1On;
+    _joystickReport.r2_axis = -(uint8_t)controllerData.r2On;
 
-    if (_joystickReport.l1_btn == 1)
-        _joystickReport.l1_axis = 0xFF;
-    else
-        _joystickReport.l1_axis = 0;
-        
-    if (_joystickReport.l2_btn == 1)
-        _joystickReport.l2_axis = 0xFF;
-    else
-        _joystickReport.l2_axis = 0;
-        
-    if (_joystickReport.r1_btn == 1)
-        _joystickReport.r1_axis = 0xFF;
-    else
-        _joystickReport.r1_axis = 0;
-            
-    if (_joystickReport.r2_btn == 1)
-        _joystickReport.r2_axis = 0xFF;
-    else
-        _joystickReport.r2_axis = 0;
-        
     _joystickReport.select_btn = controllerData.selectOn;
     _joystickReport.start_btn = controllerData.startOn;
     _joystickReport.l3_btn = controllerData.l3On;
     _joystickReport.r3_btn = controllerData.r3On;
     _joystickReport.ps_btn = controllerData.homeOn;
 
-    // digital direction, use the dir_* constants(enum)
-    // 8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
-    // 4 = down, 5 = down/left, 6 = left, 7 = left/up
-    _joystickReport.direction = 8;
-    if (controllerData.dpadUpOn == 1){
-        if (controllerData.dpadLeftOn == 1){
-            _joystickReport.direction = 7;
-        } 
-        else if (controllerData.dpadRightOn == 1){
-            _joystickReport.direction = 1;
-        }
-        else
-            _joystickReport.direction = 0;
-        
-    }
-    else if (controllerData.dpadDownOn == 1){
-                if (controllerData.dpadLeftOn == 1){
-            _joystickReport.direction = 5;
-        } 
-        else if (controllerData.dpadRightOn == 1){
-            _joystickReport.direction = 3;
-        }
-        else
-            _joystickReport.direction = 4;		
-    }
-    else if (controllerData.dpadLeftOn == 1){
-        _joystickReport.direction = 6;
-    }
-    else if (controllerData.dpadRightOn == 1){
-        _joystickReport.direction = 2;
-    }
+    // digital direction, looked up from the d-pad buttons
+    uint8_t dpad = controllerData.dpadLeftOn |
+                   (controllerData.dpadUpOn << 1) |
+                   (controllerData.dpadRightOn << 2) |
+                   (controllerData.dpadDownOn << 3);
+    _joystickReport.direction = pgm_read_byte(&_hatMap[dpad]);
+    _dpad = dpad;
             
     // left and right analog sticks, 0x00 left/up, 0x80 middle, 0xff right/down
     _joystickReport.l_x_axis = controllerData.leftStickX;
@@ -700,6 +657,69 @@ void Joystick_::set(dataForController_t controllerData)
     sendReport(&_joystickReport);
 }
 
+// Where each button that isn't on the d-pad lives in the report, as
+//  (byte << 3) | bit, in UNOJOY_ button order
+static const uint8_t _buttonBits[UNOJOY_DPAD_LEFT] PROGMEM = {
+    (0 << 3) | 3, (0 << 3) | 2, (0 << 3) | 0, (0 << 3) | 1,	// triangle, circle, square, cross
+    (0 << 3) | 4, (0 << 3) | 6, (1 << 3) | 2, (0 << 3) | 5,	// l1, l2, l3, r1
+    (0 << 3) | 7, (1 << 3) | 3, (1 << 3) | 0, (1 << 3) | 1,	// r2, r3, select, start
+    (1 << 3) | 4						// home
+};
+
+// And which pressure byte goes with it, or 0 if it hasn't got one
+static const uint8_t _buttonPressure[UNOJOY_DPAD_LEFT] PROGMEM = {
+    offsetof(JoystickReport, triangle_axis), offsetof(JoystickReport, circle_axis),
+    offsetof(JoystickReport, square_axis), offsetof(JoystickReport, cross_axis),
+    offsetof(JoystickReport, l1_axis), offsetof(JoystickReport, l2_axis),
+    0, offsetof(JoystickReport, r1_axis),
+    offsetof(JoystickReport, r2_axis), 0, 0, 0,
+    0
+};
+
+void Joystick_::setButtons(uint32_t buttons)
+{
+    for (uint8_t i = 0; i <= UNOJOY_DPAD_DOWN; i++, buttons >>= 1)
+        setButton(i, buttons & 1);
+}
+
+void Joystick_::setButton(uint8_t button, uint8_t on)
+{
+    uint8_t* report = (uint8_t*)&_joystickReport;
+    if (button > UNOJOY_DPAD_DOWN)
+        return;
+    // The d-pad buttons make up the hat switch
+    if (button >= UNOJOY_DPAD_LEFT){
+        uint8_t mask = 1 << (button - UNOJOY_DPAD_LEFT);
+        if (on)
+            _dpad |= mask;
+        else
+            _dpad &= ~mask;
+        _joystickReport.direction = pgm_read_byte(&_hatMap[_dpad]);
+        return;
+    }
+    uint8_t bit = pgm_read_byte(&_buttonBits[button]);
+    uint8_t mask = 1 << (bit & 7);
+    if (on)
+        report[bit >> 3] |= mask;
+    else
+        report[bit >> 3] &= ~mask;
+    uint8_t pressure = pgm_read_byte(&_buttonPressure[button]);
+    if (pressure)
+        report[pressure] = -(uint8_t)(on != 0);
+}
+
+void Joystick_::setAxis(uint8_t axis, uint8_t value)
+{
+    if (axis > UNOJOY_RIGHT_STICK_Y)
+        return;
+    ((uint8_t*)&_joystickReport)[offsetof(JoystickReport, l_x_axis) + axis] = value;
+}
+
+void Joystick_::commit(void)
+{
+    sendReport(&_joystickReport);
+}
+
 void Joystick_::sendReport(JoystickReport* joyReport)
 {
 	HID_SendReport(3,joyReport,sizeof(JoystickReport));
@@ -171,6 +171,21 @@ typedef struct dataForController_t
 
 dataForController_t getBlankDataForController(void);
 
+// Button and stick numbers for Joystick.setButton and Joystick.setAxis.
+//  The buttons are in the same order as in dataForController_t, so bit n
+//  of the mask you give Joystick.setButtons is button n.
+enum {
+    UNOJOY_TRIANGLE, UNOJOY_CIRCLE, UNOJOY_SQUARE, UNOJOY_CROSS,
+    UNOJOY_L1, UNOJOY_L2, UNOJOY_L3, UNOJOY_R1,
+    UNOJOY_R2, UNOJOY_R3, UNOJOY_SELECT, UNOJOY_START,
+    UNOJOY_HOME, UNOJOY_DPAD_LEFT, UNOJOY_DPAD_UP, UNOJOY_DPAD_RIGHT,
+    UNOJOY_DPAD_DOWN
+};
+enum {
+    UNOJOY_LEFT_STICK_X, UNOJOY_LEFT_STICK_Y,
+    UNOJOY_RIGHT_STICK_X, UNOJOY_RIGHT_STICK_Y
+};
+
 typedef struct {
 	// digital buttons, 0 = off, 1 = on
 	uint8_t square_btn : 1;
@@ -212,6 +227,7 @@ class Joystick_
 {
 private:
 	JoystickReport _joystickReport;
+	uint8_t _dpad;	// the d-pad buttons as {left, up, right, down}, bit 0 first
 //	void sendReport(JoystickReport* keys);
 public:
 	Joystick_(void);
@@ -221,6 +237,11 @@ public:
     void set(dataForController_t);
     dataForController_t getControllerData(void);
     dataForController_t get(void);
+    // These change the report a piece at a time, and commit sends it
+    void setButtons(uint32_t buttons);
+    void setButton(uint8_t button, uint8_t on);
+    void setAxis(uint8_t axis, uint8_t value);
+    void commit(void);
     void sendReport(JoystickReport* joyReport);
 };
 extern Joystick_ Joystick;
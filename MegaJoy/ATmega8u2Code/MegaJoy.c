@@ -45,11 +45,13 @@
  */
 
 
+#include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/wdt.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <util/crc16.h>
 #include "dataForMegaController_t.h"
 #include "usb_gamepad.h"
 
@@ -64,8 +66,8 @@ void setControllersToZero(void){
 	dataForMegaController_t emptyData;
 	for (int i = 0; i < BUTTON_ARRAY_LENGTH; i++)
 		emptyData.buttonArray[i] = 0;
-	emptyData.leftStickX = 512;
-	emptyData.leftStickY = 512;
+	emptyData.leftStickX = (AXIS_MAX + 1) / 2;
+	emptyData.leftStickY = (AXIS_MAX + 1) / 2;
 //	emptyData.rightStickX = 512;
 //	emptyData.rightStickY = 512;
 //	emptyData.stick3X = 512;
@@ -74,32 +76,92 @@ void setControllersToZero(void){
 	//sendControllerDataViaUSB(emptyData, 1);
 }
 
+// Timer1 runs free at F_CPU/64 and is our clock for serial timeouts.
+//  At 16 MHz each tick is 4 us, and since we compare times as signed
+//  16 bit differences, a deadline can be up to 131 ms away.
+#define TIMER_TICKS_PER_MS 250
+#define MS_TO_TICKS(ms) ((uint16_t)((ms) * TIMER_TICKS_PER_MS))
+#define US_TO_TICKS(us) ((uint16_t)((us) / 4))
+
+// How long we wait for each byte from the Arduino before giving up
+#define SERIAL_TIMEOUT MS_TO_TICKS(25)
+
+void timerInit(void){
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11)|(1<<CS10);
+}
+
+// Returns the current time, in timer ticks
+static inline uint16_t timerNow(void){
+	return TCNT1;
+}
+
+// Returns non-zero once the time has reached or passed the deadline
+static inline uint8_t deadlinePassed(uint16_t deadline){
+	return (int16_t)(timerNow() - deadline) >= 0;
+}
+
+// Incoming serial data is put into this ring buffer by the USART
+//  receive interrupt, so bytes never get lost while we're busy
+//  with the USB side of things.  The size has to be a power of two.
+#define SERIAL_RX_BUFFER_SIZE 32
+#define SERIAL_RX_BUFFER_MASK (SERIAL_RX_BUFFER_SIZE - 1)
+static volatile uint8_t serialRxBuffer[SERIAL_RX_BUFFER_SIZE];
+static volatile uint8_t serialRxHead = 0;
+static volatile uint8_t serialRxTail = 0;
+
+ISR(USART1_RX_vect){
+	uint8_t data = UDR1;
+	uint8_t nextHead = (serialRxHead + 1) & SERIAL_RX_BUFFER_MASK;
+	// If the buffer is full, the byte is dropped
+	if (nextHead != serialRxTail){
+		serialRxBuffer[serialRxHead] = data;
+		serialRxHead = nextHead;
+	}
+}
+
 // Initializes the USART to receive and transmit,
 //  takes in a value you can find in the datasheet
 //  based on desired communication and clock speeds
 void USART_Init(uint16_t baudSetting){
 	// Set baud rate
 	UBRR1 = baudSetting;
-	// Enable receiver and transmitter
-	UCSR1B = (1<<RXEN1)|(1<<TXEN1);
+	// Enable receiver, transmitter, and the receive interrupt
+	UCSR1B = (1<<RXEN1)|(1<<TXEN1)|(1<<RXCIE1);
 	// Set frame format: 8data, 1stop bit
 	UCSR1C = (1<<UCSZ10)|(1<<UCSZ11);	
 }
 
+// Returns how many received bytes are waiting in the buffer
+uint8_t serialAvailable(void){
+	return (serialRxHead - serialRxTail) & SERIAL_RX_BUFFER_MASK;
+}
+
+// Non-blocking read - if there's a byte in the buffer, this puts it
+//  in *data and returns 1.  Otherwise it returns 0 straight away.
+uint8_t serialTryRead(uint8_t* data){
+	uint8_t tail = serialRxTail;
+	if (tail == serialRxHead)
+		return 0;
+	*data = serialRxBuffer[tail];
+	serialRxTail = (tail + 1) & SERIAL_RX_BUFFER_MASK;
+	return 1;
+}
+
 // This reads the USART serial port, returning any data that's in the
-//  buffer, or a guaranteed zero if it took longer than timeout ms
-//  Input: uint_16 timeout - milliseconds to wait for data before timing out
+//  buffer, or a guaranteed zero if it took longer than timeout
+//  Input: uint_16 timeout - timer ticks to wait for data before timing out
+//         (use MS_TO_TICKS or US_TO_TICKS to make one)
 unsigned char serialRead( uint16_t timeout ){
+	uint16_t deadline = timerNow() + timeout;
+	uint8_t data;
 	// Wait for data to be received 
-	while ( !(UCSR1A & (1<<RXC1)) ){
-		_delay_ms(1);
-		timeout--;
-		if (timeout == 0){
+	while (!serialTryRead(&data)){
+		if (deadlinePassed(deadline)){
 			return 0b0;
-		}			
-	}	
-	// Get and return received data from buffer 
-	return UDR1;
+		}
+	}
+	return data;
 }
 
 // This sends out a byte of data via the USART.
@@ -114,9 +176,7 @@ void serialWrite( unsigned char data )
 
 void flushSerialRead()
 {
-	unsigned char dummy;
-	while ( UCSR1A & (1<<RXC1) )
-		dummy = UDR1;
+	serialRxTail = serialRxHead;
 }
 
 // This turns on one of the LEDs hooked up to the chip
@@ -131,18 +191,116 @@ void LEDoff(char ledNumber){
 	PORTD |= 1 << ledNumber;
 }
 
-// Get a 16 bit value off the serial port by doing two successive reads
-//  Assumes that data is being transmitted high byte first
-int16_t get16bitValue(int serialIndex){
-	int16_t returnValue = 0;
-	serialWrite(serialIndex);
-	serialIndex++;
-	returnValue = serialRead(25);
+// Waits for a byte until the deadline.  Returns 1 and puts the
+//  byte in *data if one came in, or 0 if we ran out of time.
+uint8_t serialReadBefore(uint8_t* data, uint16_t deadline){
+	while (!serialTryRead(data)){
+		if (deadlinePassed(deadline))
+			return 0;
+	}
+	return 1;
+}
+
+// These have to match the codes in MegaJoy.h on the Arduino side.
+//  SERIAL_SNAPSHOT_REQUEST asks for the whole megaJoyControllerData_t,
+//  which comes back as a frame:
+//    SERIAL_FRAME_START, MEGA_DATA_SIZE, the data, then a CRC-8
+//  of the length and data bytes.
+#define SERIAL_SNAPSHOT_REQUEST 0xF0
+#define SERIAL_FRAME_START 0xA5
+
+// The Arduino's megaJoyControllerData_t has 8 bytes of buttons,
+//  four for each player, then a byte with both players' d-pads,
+//  then six 16 bit axes for player one and six for player two
+#define MEGA_BUTTON_START 0
+#define MEGA_DPAD_BYTE (2 * BUTTON_ARRAY_LENGTH)
+#define MEGA_AXIS_START (MEGA_DPAD_BYTE + 1)
+#define MEGA_AXES_PER_PLAYER 6
+#define MEGA_DATA_SIZE (MEGA_AXIS_START + 2 * 2 * MEGA_AXES_PER_PLAYER)
+
+// Asks the Arduino for all the controller data in one go.
+//  Returns 0 if we got a good frame, which is copied into megaBytes,
+//  or 1 if we didn't, in which case megaBytes is left alone.
+uint8_t getSnapshotFromArduino(uint8_t* megaBytes){
+	uint8_t frameBytes[MEGA_DATA_SIZE];
+	uint8_t data, crc;
+	flushSerialRead();
+	serialWrite(SERIAL_SNAPSHOT_REQUEST);
+	uint16_t deadline = timerNow() + SERIAL_TIMEOUT;
+	// Skip anything that isn't the start of a frame
+	do {
+		if (!serialReadBefore(&data, deadline))
+			return 1;
+	} while (data != SERIAL_FRAME_START);
+	if (!serialReadBefore(&data, deadline) || data != MEGA_DATA_SIZE)
+		return 1;
+	crc = _crc_ibutton_update(0, data);
+	for (uint8_t i = 0; i < MEGA_DATA_SIZE; i++){
+		if (!serialReadBefore(&frameBytes[i], deadline))
+			return 1;
+		crc = _crc_ibutton_update(crc, frameBytes[i]);
+	}
+	if (!serialReadBefore(&data, deadline) || data != crc)
+		return 1;
+	memcpy(megaBytes, frameBytes, MEGA_DATA_SIZE);
+	return 0;
+}
+
+// This gets the controller data the old way, by asking for each
+//  byte in turn, for sketches built with older copies of MegaJoy.h.
+//  Any byte that times out keeps its old value.
+//  Returns 0 if every byte came back, or 1 if any timed out.
+uint8_t getBytewiseFromArduino(uint8_t* megaBytes){
+	uint8_t result = 0;
+	flushSerialRead();
+	for (uint8_t i = 0; i < MEGA_DATA_SIZE; i++){
+		serialWrite(i);
+		if (!serialReadBefore(&megaBytes[i], timerNow() + SERIAL_TIMEOUT))
+			result = 1;
+	}
+	return result;
+}
+
+// If snapshots keep failing while byte by byte fetches work,
+//  the sketch is using an old MegaJoy.h, so we stop asking for them
+#define SNAPSHOT_FAILURE_LIMIT 3
+
+// Gets the controller data for both players from the Arduino
+void getDataFromArduino(uint8_t* megaBytes){
+	static uint8_t useSnapshots = 1;
+	static uint8_t snapshotFailures = 0;
+	if (useSnapshots){
+		if (getSnapshotFromArduino(megaBytes) == 0){
+			snapshotFailures = 0;
+			return;
+		}
+		if (getBytewiseFromArduino(megaBytes) == 0 &&
+		    ++snapshotFailures >= SNAPSHOT_FAILURE_LIMIT)
+			useSnapshots = 0;
+		return;
+	}
+	getBytewiseFromArduino(megaBytes);
+}
+
+// Pulls one player's data out of what the Arduino sent us.
+//  player is 0 for player one, or 1 for player two.
+void unpackPlayerData(const uint8_t* megaBytes, uint8_t player, dataForMegaController_t* controllerData){
+	memcpy(controllerData->buttonArray, &megaBytes[MEGA_BUTTON_START + player * BUTTON_ARRAY_LENGTH], BUTTON_ARRAY_LENGTH);
+	
+	uint8_t directionButtons = megaBytes[MEGA_DPAD_BYTE] >> (player * 4);
+	controllerData->dpadLeftOn = 1 & (directionButtons >> 0);
+	controllerData->dpadUpOn = 1 & (directionButtons >> 1);
+	controllerData->dpadRightOn = 1 & (directionButtons >> 2);
+	controllerData->dpadDownOn = 1 & (directionButtons >> 3);
 	
-	serialWrite(serialIndex);
-	serialIndex++;
-	returnValue += serialRead(25) << 8;	
-	return returnValue;
+	// The 16 bit values are sent low byte first
+	const uint8_t* axis = &megaBytes[MEGA_AXIS_START + player * 2 * MEGA_AXES_PER_PLAYER];
+	controllerData->leftStickX = axis[0] | (axis[1] << 8);
+	controllerData->leftStickY = axis[2] | (axis[3] << 8);
+	controllerData->rightStickX = axis[4] | (axis[5] << 8);
+	controllerData->rightStickY = axis[6] | (axis[7] << 8);
+	controllerData->stick3X = axis[8] | (axis[9] << 8);
+	controllerData->stick3Y = axis[10] | (axis[11] << 8);
 }
 
 int main(void) {
@@ -151,6 +309,9 @@ int main(void) {
 	MCUSR &= ~(1 << WDRF); 
 	wdt_disable();
 
+	// Start the timer we use for serial timeouts
+	timerInit();
+
 	// Start up the USART for serial communications
 	// 25 corresponds to 38400 baud - see datasheet for more values
 	USART_Init(25);// 103 corresponds to 9600, 8 corresponds to 115200 baud, 3 for 250000
@@ -172,80 +333,36 @@ int main(void) {
 	// This wait also gives the Arduino bootloader time to timeout,
 	//  so the serial data you'll be properly aligned.
 	_delay_ms(500);
+	uint8_t megaBytes[MEGA_DATA_SIZE];
 	dataForMegaController_t controllerData1;
 	dataForMegaController_t controllerData2;
+	// Start out with no buttons pressed and every axis centered, in case
+	//  the Arduino doesn't answer before our first report goes out
+	memset(megaBytes, 0, sizeof(megaBytes));
+	for (uint8_t i = MEGA_AXIS_START; i < MEGA_DATA_SIZE; i += 2){
+		megaBytes[i] = (uint8_t)(1 << (AXIS_BITS - 1));
+		megaBytes[i + 1] = (1 << (AXIS_BITS - 1)) >> 8;
+	}
 
 	while (1) {
-		// Delay so we're not going too fast
-		_delay_ms(10);
+		// Delay so we're not going faster than the host polls us
+		_delay_ms(GAMEPAD_INTERVAL);
 		
-        // We get our data from the ATmega328p by writing which byte we
-        //  want from the dataForController_t, and then wait for the
-        //  ATmega328p to send that back to us.
-        // The serialRead(number) function reads the serial port, and the
-        //  number is a timeout (in ms) so if there's a transmission error,
-        //  we don't stall forever.
+        // We get the data for both players from the ATmega328p in
+        //  one go, so they're both from the same moment.
+        // Every read has a timeout (SERIAL_TIMEOUT) so if there's a
+        //  transmission error, we don't stall forever.
 		LEDon(TXLED);
-		flushSerialRead();
-		
-		int serialIndex = 0;
-		// The buttons are held in an array, so we need to break it between the two controllers
-		for (int i = 0; i < BUTTON_ARRAY_LENGTH; i++){
-			serialWrite(serialIndex);
-			serialIndex++;
-			controllerData1.buttonArray[i] = serialRead(25);	
-		}
-		
-		for (int i = 0; i < BUTTON_ARRAY_LENGTH; i++){
-			serialWrite(serialIndex);
-			serialIndex++;
-			controllerData2.buttonArray[i] = serialRead(25);
-		}
-		
-		serialWrite(serialIndex);
-		serialIndex++;
-		uint8_t directionButtons = serialRead(25);
-		controllerData1.dpadLeftOn = 1 & (directionButtons >> 0);
-		controllerData1.dpadUpOn = 1 & (directionButtons >> 1);
-		controllerData1.dpadRightOn = 1 & (directionButtons >> 2);
-		controllerData1.dpadDownOn = 1 & (directionButtons >> 3);
-		
-		controllerData2.dpadLeftOn = 1 & (directionButtons >> 4);
-		controllerData2.dpadUpOn = 1 & (directionButtons >> 5);
-		controllerData2.dpadRightOn = 1 & (directionButtons >> 6);
-		controllerData2.dpadDownOn = 1 & (directionButtons >> 7);
-		
-		// Assuming that 16 bit data gets sent high byte first
-		controllerData1.leftStickX = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData1.leftStickY = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData1.rightStickX = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData1.rightStickY = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData1.stick3X = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData1.stick3Y = get16bitValue(serialIndex);
-		serialIndex += 2;
+		getDataFromArduino(megaBytes);
+		// Communication with the Arduino chip is over here
+		LEDoff(TXLED);
 		
-		controllerData2.leftStickX = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData2.leftStickY = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData2.rightStickX = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData2.rightStickY = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData2.stick3X = get16bitValue(serialIndex);
-		serialIndex += 2;
-		controllerData2.stick3Y = get16bitValue(serialIndex);
+		unpackPlayerData(megaBytes, 0, &controllerData1);
+		unpackPlayerData(megaBytes, 1, &controllerData2);
 		
-		// Communication with the Arduino chip is over here
-		LEDoff(TXLED);	
-        // Finally, we send the data out via the USB port
+        // Finally, we send the data out via the USB port.  Both reports
+        //  go out back to back, so neither player is behind the other.
 		sendControllerDataViaUSB(controllerData1, 1);	
-		_delay_ms(10);
 		sendControllerDataViaUSB(controllerData2, 2);
 	}
 }
\ No newline at end of file
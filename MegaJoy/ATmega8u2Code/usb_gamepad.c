@@ -87,8 +87,13 @@
 
 #define GAMEPAD_INTERFACE	0
 #define GAMEPAD_ENDPOINT	1
-#define GAMEPAD_SIZE		64
-#define GAMEPAD_BUFFER	EP_SINGLE_BUFFER //EP_DOUBLE_BUFFER
+// We double buffer the endpoint, so both players' reports can be
+//  loaded back to back and the host picks them up on its next two
+//  polls.  The 8u2 only has 176 bytes of endpoint memory, so two 64
+//  byte banks won't fit next to endpoint 0.  Our reports are 30
+//  bytes, so the banks are 32 bytes each instead.
+#define GAMEPAD_SIZE		32
+#define GAMEPAD_BUFFER	EP_DOUBLE_BUFFER
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(GAMEPAD_SIZE) | GAMEPAD_BUFFER,
@@ -155,9 +160,9 @@ static const uint8_t PROGMEM gamepad_hid_report_desc[] = {
 	0x95, 0x01,        //   REPORT_COUNT (1)
 	0x81, 0x01,        //   INPUT (Cnst,Ary,Abs)
 	0x16, 0x00, 0x00,  //   LOGICAL_MINIMUM 0
-	0x26, 0xff, 0x03,  //   LOGICAL_MAXIMUM (1024)
+	0x26, AXIS_MAX & 0xff, AXIS_MAX >> 8,  //   LOGICAL_MAXIMUM (AXIS_MAX)
 	0x36, 0x00, 0x00,  //   PHYSICAL_MINIMUM (0)
-	0x46, 0xff, 0x03,  //   PHYSICAL_MAXIMUM (1024)
+	0x46, AXIS_MAX & 0xff, AXIS_MAX >> 8,  //   PHYSICAL_MAXIMUM (AXIS_MAX)
 	0x09, 0x30,        //   USAGE (X)
 	0x09, 0x31,        //   USAGE (Y)
 	0x09, 0x32,        //   USAGE (Z)
@@ -215,9 +220,9 @@ static const uint8_t PROGMEM gamepad_hid_report_desc[] = {
 	0x95, 0x01,        //   REPORT_COUNT (1)
 	0x81, 0x01,        //   INPUT (Cnst,Ary,Abs)
 	0x16, 0x00, 0x00,  //   LOGICAL_MINIMUM 0
-	0x26, 0xff, 0x03,  //   LOGICAL_MAXIMUM (1024)
+	0x26, AXIS_MAX & 0xff, AXIS_MAX >> 8,  //   LOGICAL_MAXIMUM (AXIS_MAX)
 	0x36, 0x00, 0x00,  //   PHYSICAL_MINIMUM (0)
-	0x46, 0xff, 0x03,  //   PHYSICAL_MAXIMUM (1024)
+	0x46, AXIS_MAX & 0xff, AXIS_MAX >> 8,  //   PHYSICAL_MAXIMUM (AXIS_MAX)
 	0x09, 0x30,        //   USAGE (X)
 	0x09, 0x31,        //   USAGE (Y)
 	0x09, 0x32,        //   USAGE (Z)
@@ -289,7 +294,7 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	GAMEPAD_ENDPOINT | 0x80,		// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	GAMEPAD_SIZE, 0,			// wMaxPacketSize
-	10					// bInterval
+	GAMEPAD_INTERVAL			// bInterval
 };
 
 // If you're desperate for a little extra code memory, these strings
@@ -427,197 +432,104 @@ inline void usb_gamepad_1_reset_state(void) {
 	memcpy_P(&usbControllerState, &gamepad_1_idle_state, sizeof(gamepad_state_t));
 }
 
-// sendPS3Data takes in a PhysicalButtonList data struct,
-//  maps the data to the format for our gamepad packet,
-//  sends that data out via USB,  and outputs
-//  a return code (zero if no problems, one if problems
-int8_t sendControllerDataViaUSB(dataForMegaController_t btnList, uint8_t playerID){
-	usbControllerState.id = playerID;
-	
-	memcpy(usbControllerState.buttonArray, btnList.buttonArray, BUTTON_ARRAY_LENGTH);
-/*	usbControllerState.triangle_btn = btnList.triangleOn;//Button 4
-	usbControllerState.square_btn = btnList.squareOn;	
-	usbControllerState.cross_btn = btnList.crossOn;
-	usbControllerState.circle_btn = btnList.circleOn;
-
-	usbControllerState.l1_btn = btnList.l1On;
-	usbControllerState.r1_btn = btnList.r1On;
-	usbControllerState.l2_btn = btnList.l2On;
-	usbControllerState.r2_btn = btnList.r2On;
-		
-	
-	if (usbControllerState.triangle_btn == 1)
-		usbControllerState.triangle_axis = 0xFF;
-	else
-		usbControllerState.triangle_axis = 0;
-		
-	if (usbControllerState.square_btn == 1)
-		usbControllerState.square_axis = 0xFF;
-	else
-		usbControllerState.square_axis = 0;
-
-	if (usbControllerState.cross_btn == 1)
-		usbControllerState.cross_axis = 0xFF;
-	else
-		usbControllerState.cross_axis = 0;
-
-	if (usbControllerState.circle_btn == 1)
-		usbControllerState.circle_axis = 0xFF;
-	else
-		usbControllerState.circle_axis = 0;
-
-	if (usbControllerState.l1_btn == 1)
-		usbControllerState.l1_axis = 0xFF;
-	else
-		usbControllerState.l1_axis = 0;
-		
-	if (usbControllerState.l2_btn == 1)
-		usbControllerState.l2_axis = 0xFF;
-	else
-		usbControllerState.l2_axis = 0;
-		
-	if (usbControllerState.r1_btn == 1)
-		usbControllerState.r1_axis = 0xFF;
-	else
-		usbControllerState.r1_axis = 0;
-			
-	if (usbControllerState.r2_btn == 1)
-		usbControllerState.r2_axis = 0xFF;
-	else
-		usbControllerState.r2_axis = 0;
-		
-	usbControllerState.select_btn = btnList.selectOn;
-	usbControllerState.start_btn = btnList.startOn;
-	usbControllerState.l3_btn = btnList.l3On;
-	usbControllerState.r3_btn = btnList.r3On;
-	
-	//gamepad_state.r2_btn_alt = btnList.r2On;
-	//gamepad_state.l2_btn_alt = btnList.l2On;
-	usbControllerState.ps_btn = btnList.homeOn;
-*/ // End of the buttons
-
-	// digital direction, use the dir_* constants(enum)
-	// 8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
-	// 4 = down, 5 = down/left, 6 = left, 7 = left/up
-
-	usbControllerState.direction = 8;
-	if (btnList.dpadUpOn == 1){
-		if (btnList.dpadLeftOn == 1){
-			usbControllerState.direction = 7;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			usbControllerState.direction = 1;
-		}
-		else
-			usbControllerState.direction = 0;
-		
-	}
-	else if (btnList.dpadDownOn == 1){
-				if (btnList.dpadLeftOn == 1){
-			usbControllerState.direction = 5;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			usbControllerState.direction = 3;
-		}
-		else
-			usbControllerState.direction = 4;		
-	}
-	else if (btnList.dpadLeftOn == 1){
-		usbControllerState.direction = 6;
-	}
-	else if (btnList.dpadRightOn == 1){
-		usbControllerState.direction = 2;
-	}
-	
-	// Take care of the d-pad analog pressures separately,
-	//  since the 'convert to hat switch' code is confusing
-	if (btnList.dpadUpOn == 1)
-		usbControllerState.up_axis = 0xFF;	
-	else
-		usbControllerState.up_axis = 0;
-	if (btnList.dpadRightOn == 1)
-		usbControllerState.right_axis = 0xFF;
-	else
-		usbControllerState.right_axis = 0;
-	if (btnList.dpadDownOn == 1)
-		usbControllerState.down_axis = 0xFF;
-	else
-		usbControllerState.down_axis = 0;
-	if (btnList.dpadLeftOn == 1)
-		usbControllerState.left_axis = 0xFF;
-	else
-		usbControllerState.left_axis = 0;
-
-
-	// left and right analog sticks, 0x00 left/up, 0x80 middle, 0xff right/down
-	// Sanity check the inputs so we don't try and go out of bounds
-	int16_t stickMin = 0;
-	int16_t stickMax = 1023;
-	if (btnList.leftStickX < stickMin)
-		btnList.leftStickX = stickMin;
-	if (btnList.leftStickX > stickMax)
-		btnList.leftStickX = stickMax;
-	if (btnList.leftStickY < stickMin)
-		btnList.leftStickY = stickMin;
-	if (btnList.leftStickY > stickMax)
-		btnList.leftStickY = stickMax;
-
-	if (btnList.rightStickX < stickMin)
-		btnList.rightStickX = stickMin;
-	if (btnList.rightStickX > stickMax)
-		btnList.rightStickX = stickMax;
-	if (btnList.rightStickY < stickMin)
-		btnList.rightStickY = stickMin;
-	if (btnList.rightStickY > stickMax)
-		btnList.rightStickY = stickMax;
-
-	if (btnList.stick3X < stickMin)
-		btnList.stick3X = stickMin;
-	if (btnList.stick3X > stickMax)
-		btnList.stick3X = stickMax;
-	if (btnList.stick3Y < stickMin)
-		btnList.stick3Y = stickMin;
-	if (btnList.stick3Y > stickMax)
-		btnList.stick3Y = stickMax;
+// This turns the d-pad into a hat switch direction.  It's indexed by
+//  the d-pad bits as {left, up, right, down}, bit 0 first, and gives
+//  8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
+//  4 = down, 5 = down/left, 6 = left, 7 = left/up
+//  Up wins over down, and left wins over right.
+static const uint8_t PROGMEM hat_map[16] = {
+	8, 6, 0, 7, 2, 6, 1, 7, 4, 5, 0, 7, 3, 5, 1, 7
+};
 
-	
-	usbControllerState.l_x_axis = btnList.leftStickX;
-	usbControllerState.l_y_axis = btnList.leftStickY;
-	usbControllerState.r_x_axis = btnList.rightStickX;
-	usbControllerState.r_y_axis = btnList.rightStickY;
-	usbControllerState.x_3_axis = btnList.stick3X;
-	usbControllerState.y_3_axis = btnList.stick3Y;
-	
-	// Send the data out via USB
-	return usb_gamepad_send();
+// The d-pad pressure bytes in gamepad_state_t are up, right, down, left,
+//  so these are the d-pad bits to look at for each of them, in that order
+static const uint8_t PROGMEM dpad_pressure_mask[4] = {
+	1<<1, 1<<2, 1<<3, 1<<0
+};
+
+// Sends a stick value, clamped to 0-AXIS_MAX, low byte first
+static inline void usb_gamepad_write_axis(int16_t value) {
+	if (value < 0)
+		value = 0;
+	if (value > AXIS_MAX)
+		value = AXIS_MAX;
+	UEDATX = (uint8_t)value;
+	UEDATX = (uint8_t)(value >> 8);
 }
 
-int8_t usb_gamepad_send(void) {
-	uint8_t intr_state, timeout, i;
+// This waits for the endpoint to be ready for a new report.
+//  Returns 0 with the endpoint selected and interrupts off,
+//  or -1 if it timed out or the USB went away.
+static int8_t usb_gamepad_wait_ready(uint8_t *intr_state) {
+	uint8_t timeout;
 
 	if (!usb_configuration) return -1;
-	intr_state = SREG;
+	*intr_state = SREG;
 	cli();
 	UENUM = GAMEPAD_ENDPOINT;
 	timeout = UDFNUML + 50;
 	while (1) {
 		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
+		if (UEINTX & (1<<RWAL)) return 0;
+		SREG = *intr_state;
 		// has the USB gone offline?
 		if (!usb_configuration) return -1;
 		// have we waited too long?
 		if (UDFNUML == timeout) return -1;
 		// get ready to try checking again
-		intr_state = SREG;
+		*intr_state = SREG;
 		cli();
 		UENUM = GAMEPAD_ENDPOINT;
 	}
+}
+
+// sendControllerDataViaUSB takes in the data for one player,
+//  builds our gamepad packet for it right in the USB endpoint,
+//  and outputs a return code (zero if no problems)
+int8_t sendControllerDataViaUSB(dataForMegaController_t btnList, uint8_t playerID){
+	uint8_t intr_state, i, dpad;
+	const uint8_t *mask = dpad_pressure_mask;
+
+	// The d-pad bits sit in the byte right after the button array,
+	//  as left, up, right, down from bit 0
+	dpad = ((uint8_t*)&btnList)[BUTTON_ARRAY_LENGTH] & 0x0F;
+
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
+	UEDATX = playerID;
+	for (i=0; i<BUTTON_ARRAY_LENGTH; i++) {
+		UEDATX = btnList.buttonArray[i];
+	}
+	UEDATX = pgm_read_byte(&hat_map[dpad]);
+
+	// left and right analog sticks, 0 left/up, AXIS_MAX right/down
+	usb_gamepad_write_axis(btnList.leftStickX);
+	usb_gamepad_write_axis(btnList.leftStickY);
+	usb_gamepad_write_axis(btnList.rightStickX);
+	usb_gamepad_write_axis(btnList.rightStickY);
+	usb_gamepad_write_axis(btnList.stick3X);
+	usb_gamepad_write_axis(btnList.stick3Y);
+
+	for (i=0; i<4; i++, mask++) {
+		// 0 - 1 is 0xFF, so this gives us 0xFF for a pressed direction
+		UEDATX = -(uint8_t)((dpad & pgm_read_byte(mask)) != 0);
+	}
+	// We don't have analog buttons, so those are all unpressed
+	for (i=0; i<8; i++) {
+		UEDATX = 0;
+	}
+	UEINTX = 0x3A;
+	SREG = intr_state;
+	return 0;
+}
+
+// usb_gamepad_send sends whatever's in usbControllerState
+int8_t usb_gamepad_send(void) {
+	uint8_t intr_state, i;
 
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
 	for (i=0; i<sizeof(gamepad_state_t); i++) {
 		UEDATX = ((uint8_t*)&usbControllerState)[i];
 	}
-
 	UEINTX = 0x3A;
 	SREG = intr_state;
 	return 0;
@@ -7,6 +7,27 @@
 // Timeout in ms for the USB communication to start during initialization
 #define USB_TIMEOUT 1000
 
+// How often, in ms, we ask the host to poll us for a report.
+//  Build with FAST_POLL defined (add -DFAST_POLL to the compiler flags)
+//  to be polled every ms, for 1000 reports a second instead of 100.
+#ifdef FAST_POLL
+#define GAMEPAD_INTERVAL 1
+#else
+#define GAMEPAD_INTERVAL 10
+#endif
+
+// How many bits the stick values have, so they run from 0 to AXIS_MAX.
+//  The sample sketch sends analogRead() values, 0-1023.  Build with
+//  -DAXIS_BITS=12 (and #define MEGAJOY_AXIS_BITS 12 in your sketch) to
+//  send oversampled values instead.
+#ifndef AXIS_BITS
+#define AXIS_BITS 10
+#endif
+#if AXIS_BITS > 15
+#error "AXIS_BITS has to fit in an int16_t"
+#endif
+#define AXIS_MAX ((1 << AXIS_BITS) - 1)
+
 uint8_t usb_init(void);			// initialize everything
 uint8_t usb_configured(void);		// is the USB port configured
 
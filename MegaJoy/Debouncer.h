@@ -0,0 +1,99 @@
+/*  Debouncer.h
+ *
+ *  Debounces all of your buttons at once.
+ *  Instead of a timer and an if() for every button, this keeps a tiny
+ *   two bit counter for each button, stored sideways across two bytes
+ *   so eight buttons count together in a handful of instructions.
+ *   A button only changes once it's read the new way four ticks in a row,
+ *   and it costs the same whether you have one button wired up or all of them.
+ *
+ *   === How to use this file ===
+ *  Add this file to your sketch, then read your buttons into bytes, one bit
+ *   per button, with a 1 meaning pressed.  scanButtonPins() from
+ *   ButtonScanner.h does that, or you can fill them in yourself.
+ *   Hand those bytes to debounceButtons() every time round your loop:
+ *
+ *   uint8_t rawButtons[DEBOUNCE_BYTES] = {0};
+ *   scanButtonPins(MY_BUTTONS, rawButtons);
+ *   debounceButtons(rawButtons);
+ *
+ *  It only actually looks at them once every DEBOUNCE_TICK_MS milliseconds,
+ *   so presses need to last four ticks - 8 ms by default.
+ *  Then debouncedButtons holds the clean button bits, in the same order as
+ *   yours, and buttonPressed(n) or buttonReleased(n) tell you if button n
+ *   has just gone down or come up.  Those are only true right after the
+ *   call that saw the change, so check them before the next one.
+ *
+ *  By default this handles 32 buttons.  #define DEBOUNCE_BYTES before
+ *   including this file to handle 8 times that many - MegaJoy's 64 buttons
+ *   need it to be 8.  #define DEBOUNCE_TICK_MS to change the tick.
+ */
+
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#ifndef DEBOUNCE_BYTES
+  #define DEBOUNCE_BYTES 4
+#endif
+
+#ifndef DEBOUNCE_TICK_MS
+  #define DEBOUNCE_TICK_MS 2
+#endif
+
+  // The debounced state of every button, 1 for pressed
+  uint8_t debouncedButtons[DEBOUNCE_BYTES];
+  // The buttons that went down, or came up, on the last tick
+  uint8_t pressedButtons[DEBOUNCE_BYTES];
+  uint8_t releasedButtons[DEBOUNCE_BYTES];
+
+  // Bit 0 and bit 1 of every button's counter.  These are kept flipped,
+  //  so that starting out at 0 means every counter starts out full.
+  uint8_t debounceCount0[DEBOUNCE_BYTES];
+  uint8_t debounceCount1[DEBOUNCE_BYTES];
+  unsigned long lastDebounceTick = 0;
+
+  // Runs one debounce tick, if it's time for one.
+  //  Returns 1 if it ran, 0 if it's not time yet.
+  uint8_t debounceButtons(const uint8_t* rawButtons){
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < DEBOUNCE_BYTES; i++){
+      pressedButtons[i] = 0;
+      releasedButtons[i] = 0;
+    }
+    if (now - lastDebounceTick < DEBOUNCE_TICK_MS)
+      return 0;
+    lastDebounceTick = now;
+
+    for (uint8_t i = 0; i < DEBOUNCE_BYTES; i++){
+      // Buttons that don't match their debounced state count down,
+      //  and the rest have their counters put back to the top.
+      uint8_t changed = debouncedButtons[i] ^ rawButtons[i];
+      uint8_t count0 = ~(~debounceCount0[i] & changed);
+      uint8_t count1 = count0 ^ (~debounceCount1[i] & changed);
+      debounceCount0[i] = ~count0;
+      debounceCount1[i] = ~count1;
+      // Counters that have rolled all the way over flip their button
+      changed &= count0 & count1;
+      debouncedButtons[i] ^= changed;
+      pressedButtons[i] = changed & debouncedButtons[i];
+      releasedButtons[i] = changed & ~debouncedButtons[i];
+    }
+    return 1;
+  }
+
+  static inline uint8_t buttonHeld(uint8_t button){
+    return (debouncedButtons[button >> 3] >> (button & 7)) & 1;
+  }
+
+  static inline uint8_t buttonPressed(uint8_t button){
+    return (pressedButtons[button >> 3] >> (button & 7)) & 1;
+  }
+
+  static inline uint8_t buttonReleased(uint8_t button){
+    return (releasedButtons[button >> 3] >> (button & 7)) & 1;
+  }
+
+#endif
@@ -12,6 +12,9 @@
  *   NOTE: You cannot use pins 0 or 1 if you use this code - they are used by the serial communication.
  *         Also, the setupMegaJoy() function starts the serial port at 38400, so if you're using
  *         the serial port to debug and it's not working, this may be your problem.
+ *         The analog axes run from 0 to 1023, like analogRead().  If you're sending oversampled
+ *         values with more bits, #define MEGAJOY_AXIS_BITS before including this file, and
+ *         build the MegaJoy firmware with the same AXIS_BITS.
  *   
  *   === How to use this library ===
  *   If you want, you can move this file into your Arduino/Libraries folder, then use it like a normal library.
@@ -48,6 +51,7 @@
 #define UNOJOY_H
     #include <stdint.h>
     #include <util/atomic.h>
+    #include <util/crc16.h>
     #include <Arduino.h>
 
     // This struct is the core of the library.
@@ -57,6 +61,10 @@
     //  the communication between the Arduino and it's communications chip.
 #define BUTTON_ARRAY_SIZE 8
 #define ANALOG_AXIS_ARRAY_SIZE 12
+#ifndef MEGAJOY_AXIS_BITS
+  #define MEGAJOY_AXIS_BITS 10
+#endif
+#define MEGAJOY_AXIS_CENTER (1 << (MEGAJOY_AXIS_BITS - 1))
     
 	typedef struct megaJoyControllerData_t
 	{
@@ -109,23 +117,36 @@
 //----- End of the interface code you should be using -----//
 //----- Below here is the actual implementation of
     
-  // This megaJoyControllerData_t is used to store
-  //  the controller data that you want to send
-  //  out to the controller.  You shouldn't mess
-  //  with this directly - call setControllerData instead
-  megaJoyControllerData_t controllerDataBuffer;
+  // The controller data that you want to send out lives in one of
+  //  these buffers.  setControllerData fills in one the timer interrupt
+  //  isn't using, then publishes it by changing publishedBuffer.
+  //  That's a single byte, so the interrupt always sees a whole update,
+  //  and we never have to turn interrupts off while we copy 33 bytes.
+  //  There are three so that the firmware can still be reading an older
+  //  one a byte at a time (servingBuffer) while we fill in the next.
+  //  You shouldn't mess with these directly - call setControllerData instead
+  #define MEGAJOY_BUFFER_COUNT 3
+  megaJoyControllerData_t controllerDataBuffers[MEGAJOY_BUFFER_COUNT];
+  volatile uint8_t publishedBuffer = 0;
+  volatile uint8_t servingBuffer = 0;
 
   // This updates the data that the controller is sending out.
   //  The system actually works as following:
-  //  The UnoJoy firmware on the ATmega8u2 regularly polls the
-  //  Arduino chip for individual bytes of a megaJoyControllerData_t.
+  //  The MegaJoy firmware on the ATmega8u2 regularly asks the
+  //  Arduino chip for the whole megaJoyControllerData_t at once,
+  //  so both players' data always comes from the same moment.
   //  
   void setControllerData(megaJoyControllerData_t controllerData){
-    // Probably unecessary, but this guarantees that the data
-    //  gets copied to our buffer all at once.
-    ATOMIC_BLOCK(ATOMIC_FORCEON){
-      controllerDataBuffer = controllerData;
-    }
+    // Fill in a buffer that isn't published, and that the firmware
+    //  isn't reading.  servingBuffer can only change to publishedBuffer
+    //  behind our back, so this one stays free until we publish it.
+    uint8_t published = publishedBuffer;
+    uint8_t serving = servingBuffer;
+    uint8_t next = 0;
+    while (next == published || next == serving)
+      next++;
+    controllerDataBuffers[next] = controllerData;
+    publishedBuffer = next;
   }
   
   // serialCheckInterval governs how many ms between
@@ -144,7 +165,9 @@
   //  and the timer interrupt for actually sending the data back and forth.
   void setupMegaJoy(void){
     // First, let's zero out our controller data buffer (center the sticks)
-    controllerDataBuffer = getBlankDataForMegaController();
+    controllerDataBuffers[0] = getBlankDataForMegaController();
+    publishedBuffer = 0;
+    servingBuffer = 0;
   
     // Start the serial port at the specific, low-error rate UnoJoy uses.
     //  If you want to change the rate, you'll have to change it in the
@@ -170,6 +193,29 @@
     setupMegaJoy();
   }
   
+  // These are the codes used on the serial line between the Arduino
+  //  and the MegaJoy firmware.  A request byte smaller than
+  //  sizeof(megaJoyControllerData_t) asks for just that byte of the
+  //  controller data.  MEGAJOY_SNAPSHOT_REQUEST asks for all of it at once,
+  //  which we send back as a frame:
+  //    MEGAJOY_FRAME_START, sizeof(megaJoyControllerData_t), the data itself,
+  //    then a CRC-8 (Dallas/Maxim) of the length and data bytes
+  #define MEGAJOY_SNAPSHOT_REQUEST 0xF0
+  #define MEGAJOY_FRAME_START 0xA5
+  
+  // This sends out the published controller data as one frame
+  void sendControllerDataFrame(void){
+    uint8_t* data = (uint8_t*)&controllerDataBuffers[publishedBuffer];
+    uint8_t length = sizeof(megaJoyControllerData_t);
+    uint8_t crc = _crc_ibutton_update(0, length);
+    for (uint8_t i = 0; i < length; i++)
+      crc = _crc_ibutton_update(crc, data[i]);
+    Serial.write(MEGAJOY_FRAME_START);
+    Serial.write(length);
+    Serial.write(data, length);
+    Serial.write(crc);
+  }
+  
   // This interrupt gets called approximately once per ms.
   //  It counts how many ms between serial port polls,
   //  and if it's been long enough, polls the serial
@@ -186,8 +232,16 @@
         // Get incoming byte from the ATmega8u2
         byte inByte = Serial.read();
         // That number tells us which byte of the megaJoyControllerData_t struct
-        //  to send out.
-        Serial.write(((uint8_t*)&controllerDataBuffer)[inByte]);
+        //  to send out, or that the firmware wants the whole thing.
+        if (inByte == MEGAJOY_SNAPSHOT_REQUEST)
+          sendControllerDataFrame();
+        else if (inByte < sizeof(megaJoyControllerData_t)){
+          // The firmware asks for the bytes in order, so we hang on to
+          //  one buffer from byte 0 on, and they all come from one update
+          if (inByte == 0)
+            servingBuffer = publishedBuffer;
+          Serial.write(((uint8_t*)&controllerDataBuffers[servingBuffer])[inByte]);
+        }
         //digitalWrite(13, LOW);
       }
     }
@@ -212,9 +266,9 @@
     controllerData.dpad1RightOn = 0;
     controllerData.dpad1DownOn = 0;  
     
-    //Set the sticks to 512 - centered
+    //Set the sticks to centered - 512, unless you changed MEGAJOY_AXIS_BITS
     for (int i = 0; i < ANALOG_AXIS_ARRAY_SIZE; i++){
-      controllerData.analogAxisArray[i] = 512;
+      controllerData.analogAxisArray[i] = MEGAJOY_AXIS_CENTER;
     }    
     // And return the data! 
     return controllerData;
@@ -1,8 +1,19 @@
 
 #include "MegaJoy.h"
+// If you set MEGAJOY_AXIS_BITS above 10, each extra bit
+//  gets filled in by oversampling the analog pins
+#define ANALOG_OVERSAMPLE_BITS (MEGAJOY_AXIS_BITS - 10)
+#include "AnalogSampler.h"
+
+// The analog pins for each axis.  AnalogSampler.h reads these in the
+//  background, so we never have to wait for analogRead()
+const uint8_t axisPins[ANALOG_AXIS_ARRAY_SIZE] = {
+  A0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11
+};
 
 void setup(){
   setupPins();
+  startAnalogSampler(axisPins, ANALOG_AXIS_ARRAY_SIZE);
   setupMegaJoy();
 }
 
@@ -40,18 +51,9 @@ megaJoyControllerData_t getControllerData(void){
   // Set the analog sticks
   //  Unlike UnoJoy, which has 8-bit analog axes for PS3 compatibilty,
   //  MegaJoy uses 10-bit analog values, to fully use the Arduino analogRead range
-  controllerData.analogAxisArray[0] = analogRead(A0);
-  controllerData.analogAxisArray[1] = analogRead(A1);
-  controllerData.analogAxisArray[2] = analogRead(A2); 
-  controllerData.analogAxisArray[3] = analogRead(A3); 
-  controllerData.analogAxisArray[4] = analogRead(A4); 
-  controllerData.analogAxisArray[5] = analogRead(A5); 
-  controllerData.analogAxisArray[6] = analogRead(A6); 
-  controllerData.analogAxisArray[7] = analogRead(A7); 
-  controllerData.analogAxisArray[8] = analogRead(A8); 
-  controllerData.analogAxisArray[9] = analogRead(A9); 
-  controllerData.analogAxisArray[10] = analogRead(A10); 
-  controllerData.analogAxisArray[11] = analogRead(A11); 
+  for (int i = 0; i < ANALOG_AXIS_ARRAY_SIZE; i++){
+    controllerData.analogAxisArray[i] = getAnalogSample(i);
+  }
   
   // And return the data!
   return controllerData;
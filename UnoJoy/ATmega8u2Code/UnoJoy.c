@@ -45,11 +45,13 @@
  */
 
 
+#include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/wdt.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <util/crc16.h>
 #include "dataForController_t.h"
 #include "usb_gamepad.h"
 
@@ -58,6 +60,55 @@
 
 #define CPU_PRESCALE(n)	(CLKPR = 0x80, CLKPR = (n))
 
+// The serial protocol between us and the Arduino works like this:
+//  Any request byte smaller than CONTROLLER_DATA_SIZE asks for that one
+//  byte of the dataForController_t, and the Arduino sends just that byte back.
+//  That's the original protocol, and the Processing visualizer still uses it.
+//  SERIAL_SNAPSHOT_REQUEST asks for the whole struct in one go - the Arduino
+//  answers with a frame that looks like:
+//    SERIAL_FRAME_START, length, sequence, data[0], ... data[length - 1], crc
+//  The sequence number goes up by one with every frame the Arduino sends,
+//  so we can tell when we've lost one, and the crc is a Dallas/Maxim CRC-8
+//  (avr-libc's _crc_ibutton_update) of everything from length to the end
+//  of the data.  Frames with a bad crc get dropped and we keep the last
+//  good data, rather than passing garbage on to the host.
+//  At 38400 baud a report costs 12 bytes on the wire and one round trip
+//  this way, instead of 14 bytes and seven round trips.
+#define SERIAL_SNAPSHOT_REQUEST 0xF0
+#define SERIAL_FRAME_START 0xA5
+#define SERIAL_FRAME_SIZE (CONTROLLER_DATA_SIZE + 4)
+
+// Rather than polling, we can ask the Arduino to push us a frame
+//  every time its data changes by sending SERIAL_STREAM_REQUEST.
+//  It answers with a frame right away, and we keep sending the request
+//  every SERIAL_KEEPALIVE_MS so it knows we're still listening.
+//  If we miss a few frames in a row, we go back to polling.
+// Set SERIAL_PUSH_MODE to 0 to always poll the Arduino the old way.
+#ifndef SERIAL_PUSH_MODE
+#define SERIAL_PUSH_MODE 1
+#endif
+#define SERIAL_STREAM_REQUEST 0xF3
+#define SERIAL_KEEPALIVE_MS 50
+#define SERIAL_MISSED_KEEPALIVE_LIMIT 3
+
+// The link always comes up at 38400 baud, which is what the Processing
+//  visualizer and older UnoJoy libraries expect.  Once we're running, we
+//  offer the Arduino faster rates by sending one of these codes, fastest
+//  first.  If the Arduino can do that rate, it echoes the code back and
+//  switches over, and then so do we.  Older libraries just ignore them.
+#define SERIAL_BAUD_DEFAULT 0
+#define SERIAL_BAUD_250K 0xE1
+#define SERIAL_BAUD_500K 0xE2
+#define SERIAL_BAUD_1M 0xE3
+// After switching, we give the Arduino this long to change over
+#define SERIAL_BAUD_SETTLE_MS 5
+// The Arduino drops back to 38400 if it doesn't get a snapshot request
+//  for 100 ms, so we wait a bit longer than that before starting over
+#define SERIAL_BAUD_RESET_MS 150
+// How many bad snapshots in a row we take at a fast rate before we
+//  decide the link is broken and go back to 38400
+#define SERIAL_LINK_FAILURE_LIMIT 3
+
 // This sets up an empty controller data packet and sends it out
 //  to all the controllers attached.
 void setControllersToZero(void){
@@ -69,35 +120,124 @@ void setControllersToZero(void){
 	sendPS3Data(emptyData);
 }
 
+// Timer1 runs free at F_CPU/64 and is our clock for serial timeouts.
+//  At 16 MHz each tick is 4 us, and since we compare times as signed
+//  16 bit differences, a deadline can be up to 131 ms away.
+#define TIMER_TICKS_PER_MS 250
+#define MS_TO_TICKS(ms) ((uint16_t)((ms) * TIMER_TICKS_PER_MS))
+#define US_TO_TICKS(us) ((uint16_t)((us) / 4))
+
+// How long we wait for each byte from the Arduino before giving up
+#define SERIAL_TIMEOUT MS_TO_TICKS(25)
+
+void timerInit(void){
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11)|(1<<CS10);
+}
+
+// Returns the current time, in timer ticks
+static inline uint16_t timerNow(void){
+	return TCNT1;
+}
+
+// Returns non-zero once the time has reached or passed the deadline
+static inline uint8_t deadlinePassed(uint16_t deadline){
+	return (int16_t)(timerNow() - deadline) >= 0;
+}
+
+// Incoming serial data is put into this ring buffer by the USART
+//  receive interrupt, so bytes never get lost while we're busy
+//  with the USB side of things.  The size has to be a power of two.
+#define SERIAL_RX_BUFFER_SIZE 32
+#define SERIAL_RX_BUFFER_MASK (SERIAL_RX_BUFFER_SIZE - 1)
+static volatile uint8_t serialRxBuffer[SERIAL_RX_BUFFER_SIZE];
+static volatile uint8_t serialRxHead = 0;
+static volatile uint8_t serialRxTail = 0;
+
+ISR(USART1_RX_vect){
+	uint8_t data = UDR1;
+	uint8_t nextHead = (serialRxHead + 1) & SERIAL_RX_BUFFER_MASK;
+	// If the buffer is full, the byte is dropped
+	if (nextHead != serialRxTail){
+		serialRxBuffer[serialRxHead] = data;
+		serialRxHead = nextHead;
+	}
+}
+
 // Initializes the USART to receive and transmit,
 //  takes in a value you can find in the datasheet
 //  based on desired communication and clock speeds
 void USART_Init(uint16_t baudSetting){
 	// Set baud rate
 	UBRR1 = baudSetting;
-	// Enable receiver and transmitter
-	UCSR1B = (1<<RXEN1)|(1<<TXEN1);
+	// Enable receiver, transmitter, and the receive interrupt
+	UCSR1B = (1<<RXEN1)|(1<<TXEN1)|(1<<RXCIE1);
 	// Set frame format: 8data, 1stop bit
 	UCSR1C = (1<<UCSZ10)|(1<<UCSZ11);	
 }
 
+// Returns how many received bytes are waiting in the buffer
+uint8_t serialAvailable(void){
+	return (serialRxHead - serialRxTail) & SERIAL_RX_BUFFER_MASK;
+}
+
+// Non-blocking read - if there's a byte in the buffer, this puts it
+//  in *data and returns 1.  Otherwise it returns 0 straight away.
+uint8_t serialTryRead(uint8_t* data){
+	uint8_t tail = serialRxTail;
+	if (tail == serialRxHead)
+		return 0;
+	*data = serialRxBuffer[tail];
+	serialRxTail = (tail + 1) & SERIAL_RX_BUFFER_MASK;
+	return 1;
+}
+
 // This reads the USART serial port, returning any data that's in the
-//  buffer, or a guaranteed zero if it took longer than timeout ms
-//  Input: uint_16 timeout - milliseconds to wait for data before timing out
+//  buffer, or a guaranteed zero if it took longer than timeout
+//  Input: uint_16 timeout - timer ticks to wait for data before timing out
+//         (use MS_TO_TICKS or US_TO_TICKS to make one)
 unsigned char serialRead( uint16_t timeout ){
+	uint16_t deadline = timerNow() + timeout;
+	uint8_t data;
 	// Wait for data to be received 
-	while ( !(UCSR1A & (1<<RXC1)) ){
-		_delay_ms(1);
-		timeout--;
-		if (timeout == 0){
+	while (!serialTryRead(&data)){
+		if (deadlinePassed(deadline)){
 			return 0b0;
-		}			
-	}	
-	// Get and return received data from buffer 
-	return UDR1;
+		}
+	}
+	return data;
+}
+
+// Which of the SERIAL_BAUD_ codes the link is running at right now
+uint8_t linkBaudCode = SERIAL_BAUD_DEFAULT;
+
+// This changes the USART over to the rate for one of the
+//  SERIAL_BAUD_ codes.  The fast rates all use double speed mode,
+//  where they come out exact at 16 MHz.
+void setLinkSpeed(uint8_t baudCode){
+	switch (baudCode){
+		case SERIAL_BAUD_1M:
+			UCSR1A |= (1<<U2X1);
+			UBRR1 = 1;
+			break;
+		case SERIAL_BAUD_500K:
+			UCSR1A |= (1<<U2X1);
+			UBRR1 = 3;
+			break;
+		case SERIAL_BAUD_250K:
+			UCSR1A |= (1<<U2X1);
+			UBRR1 = 7;
+			break;
+		default:
+			// 25 corresponds to 38400 baud
+			UCSR1A &= ~(1<<U2X1);
+			UBRR1 = 25;
+			baudCode = SERIAL_BAUD_DEFAULT;
+			break;
+	}
+	linkBaudCode = baudCode;
 }
 
-// This sends out a byte of data via the USART.
 void serialWrite( unsigned char data )
 {
 	// Wait for empty transmit buffer
@@ -109,9 +249,355 @@ void serialWrite( unsigned char data )
 
 void flushSerialRead()
 {
-	unsigned char dummy;
-	while ( UCSR1A & (1<<RXC1) )
-		dummy = UDR1;
+	serialRxTail = serialRxHead;
+}
+
+// Returns how many us have gone by since startTime, topping out at 0xFFFF
+static uint16_t usSince(uint16_t startTime){
+	uint16_t ticks = timerNow() - startTime;
+	return (ticks < 0x4000) ? ticks * 4 : 0xFFFF;
+}
+
+// The means in link_stats are running averages that weigh
+//  the newest time at 1/8
+static uint16_t runningMean(uint16_t mean, uint16_t time){
+	if (mean == 0)
+		return time;
+	return mean - (mean >> 3) + (time >> 3);
+}
+
+// This records how long a fetch from the Arduino that started at
+//  startTime took, in the fetch timing part of link_stats.
+void recordFetchTime(uint16_t startTime){
+	uint16_t fetchTime = usSince(startTime);
+	if (fetchTime < link_stats.fetch_us_min)
+		link_stats.fetch_us_min = fetchTime;
+	if (fetchTime > link_stats.fetch_us_max)
+		link_stats.fetch_us_max = fetchTime;
+	link_stats.fetch_us_mean = runningMean(link_stats.fetch_us_mean, fetchTime);
+}
+
+// This records how old the data in a report was when the host took
+//  it, counting from when we started fetching it from the Arduino
+void recordReportAge(uint16_t fetchStart){
+	uint16_t age = usSince(fetchStart);
+	if (age > link_stats.report_age_us_max)
+		link_stats.report_age_us_max = age;
+	link_stats.report_age_us_mean = runningMean(link_stats.report_age_us_mean, age);
+}
+
+// This waits until the deadline for a byte to come in, and puts it
+//  in *data.  Returns 1 if it got one, or 0 if it timed out, which
+//  gets counted in link_stats.
+uint8_t serialReadBefore(uint8_t* data, uint16_t deadline){
+	while (!serialTryRead(data)){
+		if (deadlinePassed(deadline)){
+			link_stats.timeouts++;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// These are the states of our frame parser, which pulls frames
+//  out of the receive buffer a byte at a time
+#define FRAME_WAIT_START 0
+#define FRAME_WAIT_LENGTH 1
+#define FRAME_READ_SEQUENCE 2
+#define FRAME_READ_DATA 3
+#define FRAME_READ_CRC 4
+uint8_t frameState = FRAME_WAIT_START;
+uint8_t frameIndex = 0;
+uint8_t frameCrc = 0;
+uint8_t frameSequence = 0;
+uint8_t frameBytes[CONTROLLER_DATA_SIZE];
+// Set while we're throwing away bytes that aren't part of a frame
+uint8_t frameSkipping = 0;
+// The sequence number of the last good frame, if we've had one
+uint8_t lastSequence = 0;
+uint8_t lastSequenceValid = 0;
+
+// What parseFrameByte tells us
+#define FRAME_INCOMPLETE 0
+#define FRAME_GOOD 1
+#define FRAME_BAD 2
+
+// This resets the frame parser, for when we start listening afresh
+void resetFrameParser(void){
+	frameState = FRAME_WAIT_START;
+	frameSkipping = 0;
+	lastSequenceValid = 0;
+}
+
+// This feeds one byte into the frame parser.  When it returns FRAME_GOOD,
+//  the data from the frame is waiting in frameBytes.
+uint8_t parseFrameByte(uint8_t data){
+	switch (frameState){
+		case FRAME_WAIT_START:
+			if (data == SERIAL_FRAME_START){
+				if (frameSkipping){
+					link_stats.resyncs++;
+					frameSkipping = 0;
+				}
+				frameState = FRAME_WAIT_LENGTH;
+			}
+			else
+				frameSkipping = 1;
+			break;
+		case FRAME_WAIT_LENGTH:
+			if (data == CONTROLLER_DATA_SIZE){
+				frameCrc = _crc_ibutton_update(0, data);
+				frameState = FRAME_READ_SEQUENCE;
+			}
+			else if (data != SERIAL_FRAME_START){
+				frameSkipping = 1;
+				frameState = FRAME_WAIT_START;
+			}
+			break;
+		case FRAME_READ_SEQUENCE:
+			frameSequence = data;
+			frameCrc = _crc_ibutton_update(frameCrc, data);
+			frameIndex = 0;
+			frameState = FRAME_READ_DATA;
+			break;
+		case FRAME_READ_DATA:
+			frameBytes[frameIndex++] = data;
+			frameCrc = _crc_ibutton_update(frameCrc, data);
+			if (frameIndex == CONTROLLER_DATA_SIZE)
+				frameState = FRAME_READ_CRC;
+			break;
+		case FRAME_READ_CRC:
+			frameState = FRAME_WAIT_START;
+			if (data != frameCrc){
+				link_stats.crc_errors++;
+				frameSkipping = 1;
+				return FRAME_BAD;
+			}
+			if (lastSequenceValid && frameSequence != (uint8_t)(lastSequence + 1))
+				link_stats.sequence_errors++;
+			lastSequence = frameSequence;
+			lastSequenceValid = 1;
+			link_stats.good_frames++;
+			return FRAME_GOOD;
+	}
+	return FRAME_INCOMPLETE;
+}
+
+// This asks the Arduino for a snapshot of its whole dataForController_t
+//  and reads the reply frame into controllerBytes.
+//  Returns 0 if we got a good frame, or 1 if we didn't, in which case
+//  controllerBytes is left alone.  If this never works, the Arduino is
+//  probably running an older UnoJoy library that doesn't understand
+//  snapshot requests.
+uint8_t getSnapshotFromArduino(uint8_t* controllerBytes){
+	uint8_t data;
+	frameState = FRAME_WAIT_START;
+	frameSkipping = 0;
+	serialWrite(SERIAL_SNAPSHOT_REQUEST);
+	uint16_t deadline = timerNow() + SERIAL_TIMEOUT;
+	while (serialReadBefore(&data, deadline)){
+		uint8_t result = parseFrameByte(data);
+		if (result == FRAME_GOOD){
+			memcpy(controllerBytes, frameBytes, CONTROLLER_DATA_SIZE);
+			return 0;
+		}
+		if (result == FRAME_BAD)
+			return 1;
+	}
+	return 1;
+}
+
+// This tries to move the link from 38400 up to the fastest rate
+//  the Arduino will agree to.  Each rate gets checked with a real
+//  snapshot request before we keep it, and if none of them work out
+//  we just stay at 38400.
+void negotiateLinkSpeed(void){
+	static const uint8_t baudCodes[] = {SERIAL_BAUD_1M, SERIAL_BAUD_500K, SERIAL_BAUD_250K};
+	uint8_t controllerBytes[CONTROLLER_DATA_SIZE];
+	for (uint8_t i = 0; i < sizeof(baudCodes); i++){
+		flushSerialRead();
+		serialWrite(baudCodes[i]);
+		if (serialRead(SERIAL_TIMEOUT) != baudCodes[i])
+			continue;
+		setLinkSpeed(baudCodes[i]);
+		_delay_ms(SERIAL_BAUD_SETTLE_MS);
+		flushSerialRead();
+		if (getSnapshotFromArduino(controllerBytes) == 0)
+			return;
+		// The Arduino agreed, but we can't hear each other at this
+		//  rate, so wait for it to give up and drop back to 38400 too
+		setLinkSpeed(SERIAL_BAUD_DEFAULT);
+		_delay_ms(SERIAL_BAUD_RESET_MS);
+	}
+}
+
+// This parses whatever's in the receive buffer without waiting for
+//  more.  Returns 1 if it finished at least one frame, in which
+//  case the newest one has been copied into controllerBytes.
+uint8_t getFramesFromArduino(uint8_t* controllerBytes){
+	uint8_t gotFrame = 0;
+	uint8_t data;
+	while (serialTryRead(&data)){
+		if (parseFrameByte(data) == FRAME_GOOD){
+			memcpy(controllerBytes, frameBytes, CONTROLLER_DATA_SIZE);
+			gotFrame = 1;
+		}
+	}
+	return gotFrame;
+}
+
+// Whether the Arduino is pushing frames to us
+uint8_t linkStreaming = 0;
+
+// This asks the Arduino to start pushing frames, and waits for
+//  the first one to show up in controllerBytes.
+//  Returns 1 if it did, or 0 if the Arduino doesn't do push mode.
+uint8_t startStreaming(uint8_t* controllerBytes){
+	flushSerialRead();
+	resetFrameParser();
+	serialWrite(SERIAL_STREAM_REQUEST);
+	uint16_t deadline = timerNow() + SERIAL_TIMEOUT;
+	while (!deadlinePassed(deadline)){
+		if (getFramesFromArduino(controllerBytes)){
+			linkStreaming = 1;
+			return 1;
+		}
+	}
+	linkStreaming = 0;
+	return 0;
+}
+
+// This gets the link to the Arduino going as fast as it can,
+//  and then into push mode, if we're using it
+void connectToArduino(uint8_t* controllerBytes){
+	negotiateLinkSpeed();
+#if SERIAL_PUSH_MODE
+	startStreaming(controllerBytes);
+#endif
+}
+
+// This drops the link back to 38400, waits for the Arduino
+//  to do the same, then starts over
+void reconnectToArduino(uint8_t* controllerBytes){
+	linkStreaming = 0;
+	resetFrameParser();
+	setLinkSpeed(SERIAL_BAUD_DEFAULT);
+	_delay_ms(SERIAL_BAUD_RESET_MS);
+	connectToArduino(controllerBytes);
+}
+
+// This gets the controller data from the Arduino the old way,
+//  one request and one reply for each byte.  If a byte doesn't
+//  show up, we keep the last value we had for it.
+//  Returns 0 if every byte came back, or 1 if any didn't.
+uint8_t getBytewiseFromArduino(uint8_t* controllerBytes){
+	uint8_t data;
+	uint8_t result = 0;
+	for (uint8_t i = 0; i < CONTROLLER_DATA_SIZE; i++){
+		serialWrite(i);
+		if (serialReadBefore(&data, timerNow() + SERIAL_TIMEOUT))
+			controllerBytes[i] = data;
+		else
+			result = 1;
+	}
+	return result;
+}
+
+// If snapshots keep failing while the old way works, the sketch is
+//  using an old UnoJoy library, so we stop asking for them rather than
+//  waiting out SERIAL_TIMEOUT in front of every report
+#define SNAPSHOT_FAILURE_LIMIT 3
+
+// Instead of polling the Arduino on a fixed delay, which drifts
+//  against the host, we line up with the USB start-of-frame.  We watch
+//  which frame the host polls our endpoint in, and start getting fresh
+//  data from the Arduino just long enough before the next poll is due
+//  that the report is loaded in time for it.
+// That lead has to cover a whole fetch.  A byte is 10 bits on the wire,
+//  so at 38400 baud the request byte and the SERIAL_FRAME_SIZE byte frame
+//  of a snapshot take 12 x 260 us, about 3.1 ms, and the Arduino only
+//  checks for requests every 1024 us, so it comes to about 4.2 ms.  At
+//  1M baud the same snapshot is on the wire for 120 us, so fetchLeadUs
+//  works the lead out from the rate we negotiated, and from whether we're
+//  asking for each byte the old way, which is a round trip per byte.
+//  The report age in link_stats shows how fresh the data really is when
+//  the host takes it, so you can see whether the lead is right.
+// Define SOF_PHASE_OFFSET_US to use a fixed lead instead.
+#define SOF_ARDUINO_LATENCY_US 1024
+// Time for our side of a fetch - sending, parsing and the CRC
+#define SOF_MARGIN_US 250
+// We don't wait longer than this for the host, in case it's stopped polling
+#define SOF_WAIT_TIMEOUT MS_TO_TICKS(100)
+
+// Returns how long, in us, we should start fetching
+//  from the Arduino before the host's next poll
+uint16_t fetchLeadUs(uint8_t useSnapshots){
+#ifdef SOF_PHASE_OFFSET_US
+	return SOF_PHASE_OFFSET_US;
+#else
+	uint16_t byteUs;
+	switch (linkBaudCode){
+		case SERIAL_BAUD_1M:
+			byteUs = 10;
+			break;
+		case SERIAL_BAUD_500K:
+			byteUs = 20;
+			break;
+		case SERIAL_BAUD_250K:
+			byteUs = 40;
+			break;
+		default:
+			byteUs = 261;
+			break;
+	}
+	if (useSnapshots)
+		return (1 + SERIAL_FRAME_SIZE) * byteUs + SOF_ARDUINO_LATENCY_US + SOF_MARGIN_US;
+	return CONTROLLER_DATA_SIZE * (2 * byteUs + SOF_ARDUINO_LATENCY_US) + SOF_MARGIN_US;
+#endif
+}
+
+// When the data in the report the host hasn't taken yet was fetched
+uint16_t reportFetchStart;
+uint8_t reportAgePending = 0;
+
+// This waits until it's time to fetch the data for the next report,
+//  leadUs before the host's next poll
+void waitForReportSlot(uint16_t leadUs){
+	uint16_t deadline = timerNow() + SOF_WAIT_TIMEOUT;
+	// First, wait for the host to pick up the last report
+	while (usb_gamepad_pending()){
+		if (deadlinePassed(deadline)){
+			reportAgePending = 0;
+			return;
+		}
+	}
+	if (reportAgePending){
+		recordReportAge(reportFetchStart);
+		reportAgePending = 0;
+	}
+	// The host can't poll us less often than we asked it to
+	uint8_t interval = usb_poll_interval;
+	if (interval == 0 || interval > GAMEPAD_INTERVAL)
+		interval = GAMEPAD_INTERVAL;
+	// That works out to starting this many frames before the poll...
+	uint8_t leadFrames = (leadUs + 999) / 1000;
+	// ...and this long after the start of that frame
+	uint16_t leadDelayUs = leadFrames * 1000 - leadUs;
+	// If the fetch takes longer than the interval, just start right away
+	if (leadFrames >= interval)
+		return;
+	// Then wait for the start of the frame we need to begin in
+	uint8_t fetchFrame = usb_last_poll_frame + interval - leadFrames;
+	if ((int8_t)(usb_frame_number() - fetchFrame) >= 0)
+		return;
+	while ((int8_t)(usb_frame_number() - fetchFrame) < 0){
+		if (deadlinePassed(deadline))
+			return;
+	}
+	// And finally, the rest of the lead into it
+	deadline = timerNow() + US_TO_TICKS(leadDelayUs);
+	while (!deadlinePassed(deadline)){
+	}
 }
 
 // This turns on one of the LEDs hooked up to the chip
@@ -132,6 +618,9 @@ int main(void) {
 	MCUSR &= ~(1 << WDRF); 
 	wdt_disable();
 
+	// Start the timer we use for serial timeouts
+	timerInit();
+
 	// Start up the USART for serial communications
 	// 25 corresponds to 38400 baud - see datasheet for more values
 	USART_Init(25);// 103 corresponds to 9600, 8 corresponds to 115200 baud, 3 for 250000
@@ -153,71 +642,99 @@ int main(void) {
 	// This wait also gives the Arduino bootloader time to timeout,
 	//  so the serial data you'll be properly aligned.
 	_delay_ms(500);
-	dataForController_t dataToSend;
-	char buttonData1;
-	char buttonData2;
-	char buttonData3;
+	
+	link_stats.fetch_us_min = 0xFFFF;
+	
+	// Start out with no buttons pressed and the sticks centered, in case
+	//  the Arduino doesn't answer before our first report goes out
+	uint8_t controllerBytes[CONTROLLER_DATA_SIZE];
+	memset(controllerBytes, 0, sizeof(controllerBytes));
+	controllerBytes[3] = controllerBytes[4] = controllerBytes[5] = controllerBytes[6] = 128;
+
+	// Now that the Arduino is up, see how fast we can talk to it
+	connectToArduino(controllerBytes);
+	uint8_t linkFailures = 0;
+	uint8_t useSnapshots = 1;
+	uint8_t snapshotFailures = 0;
+	uint16_t keepaliveDeadline = timerNow() + MS_TO_TICKS(SERIAL_KEEPALIVE_MS);
+	uint8_t missedKeepalives = 0;
 
 	while (1) {
-		// Delay so we're not going too fast
-		_delay_ms(10);
-		
-        // We get our data from the ATmega328p by writing which byte we
-        //  want from the dataForController_t, and then wait for the
-        //  ATmega328p to send that back to us.
-        // The serialRead(number) function reads the serial port, and the
-        //  number is a timeout (in ms) so if there's a transmission error,
-        //  we don't stall forever.
-		LEDon(TXLED);
-		flushSerialRead();
-		serialWrite(0);
-		buttonData1 = serialRead(25);
-		       
-		serialWrite(1);
-		buttonData2 = serialRead(25);
-        
-		serialWrite(2);
-		buttonData3 = serialRead(25);
-        
-		serialWrite(3);
-		dataToSend.leftStickX = serialRead(25);
-        
-		serialWrite(4);
-		dataToSend.leftStickY = serialRead(25);
-        
-		serialWrite(5);
-		dataToSend.rightStickX = serialRead(25);
-        
-		serialWrite(6);
-		dataToSend.rightStickY= serialRead(25);
-		
-		LEDoff(TXLED);
-		
-		// Now, we take the button data we got in and input that information
-        //  into our controller data we want to send
-		dataToSend.triangleOn = 1 & (buttonData1 >> 0);
-		dataToSend.circleOn = 1 & (buttonData1 >> 1);
-		dataToSend.squareOn = 1 & (buttonData1 >> 2);
-		dataToSend.crossOn = 1 & (buttonData1 >> 3);
-		dataToSend.l1On = 1 & (buttonData1 >> 4);
-		dataToSend.l2On = 1 & (buttonData1 >> 5);
-		dataToSend.l3On = 1 & (buttonData1 >> 6);
-		dataToSend.r1On = 1 & (buttonData1 >> 7);
-		
-		dataToSend.r2On = 1 & (buttonData2 >> 0);
-		dataToSend.r3On = 1 & (buttonData2 >> 1);
-		dataToSend.selectOn = 1 & (buttonData2 >> 2);
-		dataToSend.startOn = 1 & (buttonData2 >> 3);
-		dataToSend.homeOn = 1 & (buttonData2 >> 4);
-		dataToSend.dpadLeftOn = 1 & (buttonData2 >> 5);
-		dataToSend.dpadUpOn = 1 & (buttonData2 >> 6);
-		dataToSend.dpadRightOn = 1 & (buttonData2 >> 7);
+		if (linkStreaming){
+			// In push mode, we just wait for the Arduino to send us
+			//  a frame, and pass it on as soon as it's all here.
+			//  Every so often we remind the Arduino we're listening,
+			//  and if it stops answering, we start over.
+			if (deadlinePassed(keepaliveDeadline)){
+				if (missedKeepalives >= SERIAL_MISSED_KEEPALIVE_LIMIT){
+					reconnectToArduino(controllerBytes);
+					missedKeepalives = 0;
+				}
+				else {
+					if (missedKeepalives > 0)
+						link_stats.timeouts++;
+					serialWrite(SERIAL_STREAM_REQUEST);
+					missedKeepalives++;
+				}
+				keepaliveDeadline = timerNow() + MS_TO_TICKS(SERIAL_KEEPALIVE_MS);
+			}
+			if (getFramesFromArduino(controllerBytes))
+				missedKeepalives = 0;
+			// If nothing new came in, we only resend the last
+			//  report once the host's idle period runs out
+			else if (!usb_gamepad_idle_expired())
+				continue;
+		}
+		else {
+			// Wait until it's time to get the next report ready
+			waitForReportSlot(fetchLeadUs(useSnapshots));
 		
-		dataToSend.dpadDownOn = 1 & (buttonData3 >> 0);
+			// We get our data from the ATmega328p by asking it for a snapshot
+			//  of its dataForController_t, and then waiting for the
+			//  ATmega328p to send the whole thing back to us.
+			// If the Arduino doesn't answer with a proper frame at 38400, we
+			//  fall back to asking for each byte individually, so sketches
+			//  built with older versions of the UnoJoy library still work,
+			//  and after SNAPSHOT_FAILURE_LIMIT of those in a row we stick
+			//  with asking for each byte.
+			// The serialRead(number) function reads the serial port, and the
+			//  number is a timeout (SERIAL_TIMEOUT) so if there's a transmission error,
+			//  we don't stall forever.
+			LEDon(TXLED);
+			flushSerialRead();
+			uint16_t fetchStart = timerNow();
+			if (useSnapshots && getSnapshotFromArduino(controllerBytes) == 0){
+				recordFetchTime(fetchStart);
+				linkFailures = 0;
+				snapshotFailures = 0;
+			}
+			else if (linkBaudCode == SERIAL_BAUD_DEFAULT){
+				flushSerialRead();
+				fetchStart = timerNow();
+				if (getBytewiseFromArduino(controllerBytes) == 0 && useSnapshots
+						&& ++snapshotFailures >= SNAPSHOT_FAILURE_LIMIT)
+					useSnapshots = 0;
+				recordFetchTime(fetchStart);
+			}
+			// Only libraries that know about snapshots ever agree to a
+			//  faster rate, so if they stop answering, the Arduino has
+			//  probably been reset - go back to 38400 and start again.
+			else if (++linkFailures >= SERIAL_LINK_FAILURE_LIMIT){
+				reconnectToArduino(controllerBytes);
+				linkFailures = 0;
+			}
+			LEDoff(TXLED);
+			reportFetchStart = fetchStart;
+		}
 		
-        
-        // Finally, we send the data out via the USB port
-		sendPS3Data(dataToSend);	
+		// Finally, we turn the data from the Arduino into a report
+		//  and send it out via the USB port.  If it's the same as the
+		//  last one, nothing gets loaded, and there's no age to measure
+		//  when the host next polls.
+		uint16_t reportsBefore = link_stats.reports_sent;
+		sendPS3Report(controllerBytes);
+		if (!linkStreaming && link_stats.reports_sent != reportsBefore)
+			reportAgePending = 1;
 		
 	}
 }
\ No newline at end of file
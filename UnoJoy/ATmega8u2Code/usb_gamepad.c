@@ -86,8 +86,18 @@
 
 #define GAMEPAD_INTERFACE	0
 #define GAMEPAD_ENDPOINT	1
+// With FAST_POLL, we double buffer the endpoint so the next report
+//  can be loaded while the host is still picking up the last one.
+//  The 8u2 only has 176 bytes of endpoint memory, so two 64 byte
+//  banks won't fit next to endpoint 0.  Our reports are all under
+//  32 bytes, so the banks are 32 bytes each instead.
+#ifdef FAST_POLL
+#define GAMEPAD_SIZE		32
+#define GAMEPAD_BUFFER	EP_DOUBLE_BUFFER
+#else
 #define GAMEPAD_SIZE		64
-#define GAMEPAD_BUFFER	EP_SINGLE_BUFFER //EP_DOUBLE_BUFFER
+#define GAMEPAD_BUFFER	EP_SINGLE_BUFFER
+#endif
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(GAMEPAD_SIZE) | GAMEPAD_BUFFER,
@@ -223,7 +233,7 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	GAMEPAD_ENDPOINT | 0x80,		// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	GAMEPAD_SIZE, 0,			// wMaxPacketSize
-	10					// bInterval
+	GAMEPAD_INTERVAL			// bInterval
 };
 
 // If you're desperate for a little extra code memory, these strings
@@ -305,6 +315,23 @@ static uint8_t gamepad_idle_config = 0;
 // are required to be able to report which setting is in use.
 static uint8_t gamepad_protocol = 1;
 
+// These track when the host polls our endpoint, so the main loop can
+//  time its work to land just before the next poll.  Frame numbers are
+//  the low byte of the USB frame number, which goes up once per ms.
+volatile uint8_t usb_last_poll_frame = 0;
+volatile uint8_t usb_poll_interval = GAMEPAD_INTERVAL;
+
+// set when we've loaded a report the host hasn't picked up yet
+static volatile uint8_t gamepad_report_pending = 0;
+
+// We only send a report when something in it changed, or when the
+//  idle period the host set with SET_IDLE runs out.  This is the
+//  controller data for the last report we sent, and how many ms it's
+//  been since we sent one.
+static uint8_t gamepad_last_sent[CONTROLLER_DATA_SIZE];
+static uint8_t gamepad_last_sent_valid = 0;
+static volatile uint16_t gamepad_idle_ms = 0;
+
 /**************************************************************************
  *
  *  Public Functions - these are the API intended for the user
@@ -340,170 +367,183 @@ uint8_t usb_configured(void) {
 	return usb_configuration;
 }
 
+// return the low byte of the current USB frame number
+uint8_t usb_frame_number(void) {
+	return UDFNUML;
+}
+
+// return 1 if the host hasn't picked up the last report we sent yet
+uint8_t usb_gamepad_pending(void) {
+	return gamepad_report_pending;
+}
+
+// return 1 if the host's idle period has run out, and it's
+// expecting a report from us even if nothing has changed
+uint8_t usb_gamepad_idle_expired(void) {
+	uint16_t idle_ms;
+	// The SOF interrupt counts gamepad_idle_ms up, so we read both
+	// bytes of it with interrupts off
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		idle_ms = gamepad_idle_ms;
+	}
+	return gamepad_idle_config != 0 && idle_ms >= (uint16_t)gamepad_idle_config * 4;
+}
+
 gamepad_state_t gamepad_state;
 
+link_stats_t link_stats;
+
 inline void usb_gamepad_reset_state(void) {
 	memcpy_P(&gamepad_state, &gamepad_idle_state, sizeof(gamepad_state_t));
 }
 
-// sendPS3Data takes in a PhysicalButtonList data struct,
-//  maps the data to the format for our gamepad packet,
-//  sends that data out via USB,  and outputs
-//  a return code (zero if no problems, one if problems
-int8_t sendPS3Data(dataForController_t btnList){
-	
-	gamepad_state.triangle_btn = btnList.triangleOn;//Button 4
-	gamepad_state.square_btn = btnList.squareOn;	
-	gamepad_state.cross_btn = btnList.crossOn;
-	gamepad_state.circle_btn = btnList.circleOn;
-
-	gamepad_state.l1_btn = btnList.l1On;
-	gamepad_state.r1_btn = btnList.r1On;
-	gamepad_state.l2_btn = btnList.l2On;
-	gamepad_state.r2_btn = btnList.r2On;
-		
-	
-	if (gamepad_state.triangle_btn == 1)
-		gamepad_state.triangle_axis = 0xFF;
-	else
-		gamepad_state.triangle_axis = 0;
-		
-	if (gamepad_state.square_btn == 1)
-		gamepad_state.square_axis = 0xFF;
-	else
-		gamepad_state.square_axis = 0;
-
-	if (gamepad_state.cross_btn == 1)
-		gamepad_state.cross_axis = 0xFF;
-	else
-		gamepad_state.cross_axis = 0;
-
-	if (gamepad_state.circle_btn == 1)
-		gamepad_state.circle_axis = 0xFF;
-	else
-		gamepad_state.circle_axis = 0;
-
-	if (gamepad_state.l1_btn == 1)
-		gamepad_state.l1_axis = 0xFF;
-	else
-		gamepad_state.l1_axis = 0;
-		
-	if (gamepad_state.l2_btn == 1)
-		gamepad_state.l2_axis = 0xFF;
-	else
-		gamepad_state.l2_axis = 0;
-		
-	if (gamepad_state.r1_btn == 1)
-		gamepad_state.r1_axis = 0xFF;
-	else
-		gamepad_state.r1_axis = 0;
-			
-	if (gamepad_state.r2_btn == 1)
-		gamepad_state.r2_axis = 0xFF;
-	else
-		gamepad_state.r2_axis = 0;
-		
-	gamepad_state.select_btn = btnList.selectOn;
-	gamepad_state.start_btn = btnList.startOn;
-	gamepad_state.l3_btn = btnList.l3On;
-	gamepad_state.r3_btn = btnList.r3On;
-	
-	//gamepad_state.r2_btn_alt = btnList.r2On;
-	//gamepad_state.l2_btn_alt = btnList.l2On;
-	gamepad_state.ps_btn = btnList.homeOn;
-
-	// digital direction, use the dir_* constants(enum)
-	// 8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
-	// 4 = down, 5 = down/left, 6 = left, 7 = left/up
-
-	gamepad_state.direction = 8;
-	if (btnList.dpadUpOn == 1){
-		if (btnList.dpadLeftOn == 1){
-			gamepad_state.direction = 7;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			gamepad_state.direction = 1;
-		}
-		else
-			gamepad_state.direction = 0;
-		
-	}
-	else if (btnList.dpadDownOn == 1){
-				if (btnList.dpadLeftOn == 1){
-			gamepad_state.direction = 5;
-		} 
-		else if (btnList.dpadRightOn == 1){
-			gamepad_state.direction = 3;
+// These tables turn the controller data from the Arduino straight into
+//  our PS3 report.  See dataForController_t.h (or UnoJoy.h on the Arduino
+//  side) for the layout - the first three bytes are the button bits:
+//    byte 0: triangle, circle, square, cross, l1, l2, l3, r1
+//    byte 1: r2, r3, select, start, home, dpad left, dpad up, dpad right
+//    byte 2: dpad down
+//  and the last four are the stick positions.
+
+// Where each bit of the report's two button bytes comes from,
+//  as {controller byte, bit mask} pairs, in gamepad_state_t order
+static const uint8_t PROGMEM ps3_button_map[16][2] = {
+	{0, 1<<2}, {0, 1<<3}, {0, 1<<1}, {0, 1<<0},	// square, cross, circle, triangle
+	{0, 1<<4}, {0, 1<<7}, {0, 1<<5}, {1, 1<<0},	// l1, r1, l2, r2
+	{1, 1<<2}, {1, 1<<3}, {0, 1<<6}, {1, 1<<1},	// select, start, l3, r3
+	{1, 1<<4}, {0, 0}, {0, 0}, {0, 0}		// ps, then padding
+};
+
+// Where each of the analog pressure bytes comes from, in the
+//  same order as they appear in gamepad_state_t.  We only have
+//  digital buttons, so each one is either 0x00 or 0xFF.
+static const uint8_t PROGMEM ps3_pressure_map[12][2] = {
+	{1, 1<<7}, {1, 1<<5}, {1, 1<<6}, {2, 1<<0},	// right, left, up, down
+	{0, 1<<0}, {0, 1<<1}, {0, 1<<3}, {0, 1<<2},	// triangle, circle, cross, square
+	{0, 1<<4}, {0, 1<<7}, {0, 1<<5}, {1, 1<<0}	// l1, r1, l2, r2
+};
+
+// This turns the d-pad into a hat switch direction.  It's indexed by
+//  the d-pad bits as {left, up, right, down}, bit 0 first, and gives
+//  8 = center, 0 = up, 1 = up/right, 2 = right, 3 = right/down
+//  4 = down, 5 = down/left, 6 = left, 7 = left/up
+//  Up wins over down, and left wins over right.
+static const uint8_t PROGMEM ps3_hat_map[16] = {
+	8, 6, 0, 7, 2, 6, 1, 7, 4, 5, 0, 7, 3, 5, 1, 7
+};
+
+// This writes the report for the controller data straight into
+//  the endpoint FIFO.  The endpoint has to be selected already.
+static void usb_gamepad_write_report(const uint8_t *controller_bytes) {
+	const uint8_t *map = &ps3_button_map[0][0];
+	uint8_t i, j, bits, bit;
+
+	for (i=0; i<2; i++) {
+		bits = 0;
+		for (bit=1, j=0; j<8; j++, bit<<=1, map+=2) {
+			if (controller_bytes[pgm_read_byte(map)] & pgm_read_byte(map+1))
+				bits |= bit;
 		}
-		else
-			gamepad_state.direction = 4;		
+		UEDATX = bits;
 	}
-	else if (btnList.dpadLeftOn == 1){
-		gamepad_state.direction = 6;
+	UEDATX = pgm_read_byte(&ps3_hat_map[(controller_bytes[1] >> 5) | ((controller_bytes[2] & 1) << 3)]);
+	for (i=3; i<7; i++) {
+		UEDATX = controller_bytes[i];
 	}
-	else if (btnList.dpadRightOn == 1){
-		gamepad_state.direction = 2;
+	map = &ps3_pressure_map[0][0];
+	for (i=0; i<12; i++, map+=2) {
+		// 0 - 1 is 0xFF, so this gives us 0xFF for a pressed button
+		UEDATX = -(uint8_t)((controller_bytes[pgm_read_byte(map)] & pgm_read_byte(map+1)) != 0);
 	}
-	
-	// Take care of the d-pad analog pressures separately,
-	//  since the 'convert to hat switch' code is confusing
-	if (btnList.dpadUpOn == 1)
-		gamepad_state.up_axis = 0xFF;	
-	else
-		gamepad_state.up_axis = 0;
-	if (btnList.dpadRightOn == 1)
-		gamepad_state.right_axis = 0xFF;
-	else
-		gamepad_state.right_axis = 0;
-	if (btnList.dpadDownOn == 1)
-		gamepad_state.down_axis = 0xFF;
-	else
-		gamepad_state.down_axis = 0;
-	if (btnList.dpadLeftOn == 1)
-		gamepad_state.left_axis = 0xFF;
-	else
-		gamepad_state.left_axis = 0;
-			
-
-	// left and right analog sticks, 0x00 left/up, 0x80 middle, 0xff right/down
-
-	gamepad_state.l_x_axis = btnList.leftStickX;
-	gamepad_state.l_y_axis = btnList.leftStickY;
-	gamepad_state.r_x_axis = btnList.rightStickX;
-	gamepad_state.r_y_axis = btnList.rightStickY;
-	
-	// Send the data out via USB
-	return usb_gamepad_send();
 }
 
-int8_t usb_gamepad_send(void) {
-	uint8_t intr_state, timeout, i;
+// This waits for the endpoint to be ready for a new report.
+//  Returns 0 with the endpoint selected and interrupts off,
+//  or -1 if it timed out or the USB went away.
+static int8_t usb_gamepad_wait_ready(uint8_t *intr_state) {
+	uint8_t timeout;
 
 	if (!usb_configuration) return -1;
-	intr_state = SREG;
+	*intr_state = SREG;
 	cli();
 	UENUM = GAMEPAD_ENDPOINT;
 	timeout = UDFNUML + 50;
 	while (1) {
 		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
+		if (UEINTX & (1<<RWAL)) return 0;
+		SREG = *intr_state;
 		// has the USB gone offline?
 		if (!usb_configuration) return -1;
 		// have we waited too long?
-		if (UDFNUML == timeout) return -1;
+		if (UDFNUML == timeout) {
+			link_stats.send_timeouts++;
+			return -1;
+		}
 		// get ready to try checking again
-		intr_state = SREG;
+		*intr_state = SREG;
 		cli();
 		UENUM = GAMEPAD_ENDPOINT;
 	}
+}
 
+// This hands the report we've written to the host
+static void usb_gamepad_release(uint8_t intr_state) {
+	UEINTX = 0x3A;
+	gamepad_report_pending = 1;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		gamepad_idle_ms = 0;
+	}
+	link_stats.reports_sent++;
+	SREG = intr_state;
+}
+
+// sendPS3Report takes in the controller data, as the seven bytes
+//  the Arduino sends us, and if it's changed (or the host wants a
+//  report anyway) builds our gamepad packet from it right in the
+//  USB endpoint.  Returns zero if there were no problems.
+int8_t sendPS3Report(const uint8_t *controller_bytes) {
+	uint8_t intr_state;
+
+	// Only send the report if it's changed or the host wants to hear
+	//  from us anyway.  An idle setting of 0 means only on change,
+	//  otherwise it's in units of 4 ms.
+	if (gamepad_last_sent_valid &&
+	    memcmp(controller_bytes, gamepad_last_sent, CONTROLLER_DATA_SIZE) == 0 &&
+	    !usb_gamepad_idle_expired())
+		return 0;
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
+	usb_gamepad_write_report(controller_bytes);
+	usb_gamepad_release(intr_state);
+	memcpy(gamepad_last_sent, controller_bytes, CONTROLLER_DATA_SIZE);
+	gamepad_last_sent_valid = 1;
+	return 0;
+}
+
+// sendPS3Data takes in a dataForController_t, and sends it
+//  out the same way as sendPS3Report
+int8_t sendPS3Data(dataForController_t btnList){
+	uint8_t controller_bytes[CONTROLLER_DATA_SIZE];
+
+	// The button bits are laid out just like the Arduino sends them,
+	//  but the sticks aren't byte aligned, so we pick those out
+	memcpy(controller_bytes, &btnList, 3);
+	controller_bytes[2] &= 1;
+	controller_bytes[3] = btnList.leftStickX;
+	controller_bytes[4] = btnList.leftStickY;
+	controller_bytes[5] = btnList.rightStickX;
+	controller_bytes[6] = btnList.rightStickY;
+	return sendPS3Report(controller_bytes);
+}
+
+// usb_gamepad_send sends whatever's in gamepad_state
+int8_t usb_gamepad_send(void) {
+	uint8_t intr_state, i;
+
+	if (usb_gamepad_wait_ready(&intr_state)) return -1;
 	for (i=0; i<sizeof(gamepad_state_t); i++) {
 		UEDATX = ((uint8_t*)&gamepad_state)[i];
 	}
-
-	UEINTX = 0x3A;
-	SREG = intr_state;
+	usb_gamepad_release(intr_state);
 	return 0;
 }
 
@@ -527,6 +567,29 @@ ISR(USB_GEN_vect)
 		UEIENX = (1<<RXSTPE);
 		usb_configuration = 0;
 	}
+	// At the start of each frame, we look at whether the host polled our
+	//  endpoint during the last one - either it took the report we'd
+	//  loaded, or there wasn't one and we NAKed it.
+	if ((intbits & (1<<SOFI)) && usb_configuration) {
+		uint8_t endpoint = UENUM;
+		uint8_t polled = 0;
+		UENUM = GAMEPAD_ENDPOINT;
+		if (UEINTX & (1<<NAKINI)) {
+			UEINTX = ~(1<<NAKINI);
+			polled = 1;
+		}
+		if (gamepad_report_pending && !(UESTA0X & ((1<<NBUSYBK1)|(1<<NBUSYBK0)))) {
+			gamepad_report_pending = 0;
+			polled = 1;
+		}
+		if (polled) {
+			uint8_t frame = UDFNUML - 1;
+			usb_poll_interval = frame - usb_last_poll_frame;
+			usb_last_poll_frame = frame;
+		}
+		UENUM = endpoint;
+		if (gamepad_idle_ms < 0xFFFF) gamepad_idle_ms++;
+	}
 }
 
 // Misc functions to wait for ready and send/receive packets
@@ -628,6 +691,7 @@ ISR(USB_COM_vect)
 		}
 		if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
 			usb_configuration = wValue;
+			gamepad_last_sent_valid = 0;
 			usb_send_in();
 			cfg = endpoint_config_table;
 			for (i=1; i<5; i++) {
@@ -688,8 +752,17 @@ ISR(USB_COM_vect)
 				if (bRequest == HID_GET_REPORT) {
 					usb_wait_in_ready();
 
-					for (i=0; i<sizeof(magic_init_bytes); i++) {
-						UEDATX = pgm_read_byte(&magic_init_bytes[i]);
+					if (wValue == ((HID_REPORT_TYPE_FEATURE << 8) | LINK_STATS_REPORT_ID)) {
+						link_stats.id = LINK_STATS_REPORT_ID;
+						len = (wLength < sizeof(link_stats_t)) ? wLength : sizeof(link_stats_t);
+						for (i=0; i<len; i++) {
+							UEDATX = ((uint8_t*)&link_stats)[i];
+						}
+					}
+					else {
+						for (i=0; i<sizeof(magic_init_bytes); i++) {
+							UEDATX = pgm_read_byte(&magic_init_bytes[i]);
+						}
 					}
 
 					usb_send_in();
@@ -10,8 +10,23 @@
 // Timeout in ms for the USB communication to start during initialization
 #define USB_TIMEOUT 1000
 
+// How often, in ms, we ask the host to poll us for a report.
+//  Build with FAST_POLL defined (add -DFAST_POLL to the compiler flags)
+//  to be polled every ms, for 1000 reports a second instead of 100.
+#ifdef FAST_POLL
+#define GAMEPAD_INTERVAL 1
+#else
+#define GAMEPAD_INTERVAL 10
+#endif
+
 uint8_t usb_init(void);			// initialize everything
 uint8_t usb_configured(void);		// is the USB port configured
+uint8_t usb_frame_number(void);		// low byte of the USB frame number
+
+// The USB frame (see usb_frame_number) the host last polled us in,
+//  and how many frames there were between its last two polls
+extern volatile uint8_t usb_last_poll_frame;
+extern volatile uint8_t usb_poll_interval;
 
 // This defines our gamepad_state_t type.  This is half of changing what data UnoJoy sends out - the other half is changing
 //  the HID Report Descriptor in usb_gamepad.c to reflect the different data contained here.
@@ -78,8 +93,41 @@ extern gamepad_state_t gamepad_state;
 void usb_gamepad_reset_state(void);
 
 int8_t usb_gamepad_send(void);
+uint8_t usb_gamepad_pending(void);	// has the host not taken our last report yet
+uint8_t usb_gamepad_idle_expired(void);	// is a report due even if nothing changed
+
+// The controller data from the Arduino is 3 bytes of buttons, then 4 sticks
+#define CONTROLLER_DATA_SIZE 7
 
 int8_t sendPS3Data(dataForController_t);
+int8_t sendPS3Report(const uint8_t *controller_bytes);
+
+// These count how healthy the serial link to the Arduino is, how long
+//  it takes to get data over it, and how the USB side is keeping up.
+//  The main loop keeps them up to date, and the host can read them with
+//  a GET_REPORT for feature report LINK_STATS_REPORT_ID - see the
+//  UnoJoyLinkMonitor tool.  We don't declare that report in the HID
+//  descriptor, so the PS3 never sees it.  All the fields are little
+//  endian, and the counters just wrap around.
+#define LINK_STATS_REPORT_ID 2
+
+typedef struct {
+	uint8_t id;			// always LINK_STATS_REPORT_ID
+	uint16_t good_frames;		// frames that arrived intact
+	uint16_t crc_errors;		// frames dropped for a bad crc
+	uint16_t timeouts;		// times the Arduino didn't answer in time
+	uint16_t resyncs;		// times we skipped junk to find a frame
+	uint16_t sequence_errors;	// gaps in the frame sequence numbers
+	uint16_t fetch_us_min;		// quickest fetch from the Arduino, in us
+	uint16_t fetch_us_max;		// slowest fetch
+	uint16_t fetch_us_mean;		// running average fetch time
+	uint16_t reports_sent;		// reports loaded into the endpoint
+	uint16_t send_timeouts;		// times the endpoint stayed busy too long
+	uint16_t report_age_us_max;	// oldest data the host has taken from us, in us
+	uint16_t report_age_us_mean;	// running average age of the data it took
+} link_stats_t;
+
+extern link_stats_t link_stats;
 
 
 // Everything below this point is only intended for usb_gamepad.c
@@ -87,6 +135,7 @@ int8_t sendPS3Data(dataForController_t);
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #define EP_TYPE_CONTROL			0x00
 #define EP_TYPE_BULK_IN			0x81
@@ -153,6 +202,8 @@ int8_t sendPS3Data(dataForController_t);
 #define HID_SET_REPORT			9
 #define HID_SET_IDLE			10
 #define HID_SET_PROTOCOL		11
+
+#define HID_REPORT_TYPE_FEATURE		3
 // CDC (communication class device)
 #define CDC_SET_LINE_CODING		0x20
 #define CDC_GET_LINE_CODING		0x21
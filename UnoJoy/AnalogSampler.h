@@ -0,0 +1,132 @@
+/*  AnalogSampler.h
+ *
+ *  Reads your analog sticks in the background, so getControllerData()
+ *   doesn't have to wait on them.
+ *  analogRead() starts a conversion and then sits and waits about 100 us
+ *   for it to finish, so four sticks hold up your loop for almost half a
+ *   millisecond.  This instead keeps the ADC running from its interrupt,
+ *   going round your list of pins one after another, and keeps the newest
+ *   value for each pin ready to pick up with getAnalogSample().
+ *
+ *   === How to use this file ===
+ *  Add this file to your sketch, then in setup() give it your pins:
+ *
+ *   const uint8_t stickPins[] = {A0, A1, A2, A3};
+ *   startAnalogSampler(stickPins, 4);
+ *
+ *  and where you used to call analogRead(A2), call getAnalogSample(2) -
+ *   the number is where the pin is in your list.
+ *
+ *  By default you get the same 0-1023 values analogRead() gives you.
+ *   #define ANALOG_OVERSAMPLE_BITS before including this file to add up
+ *   4, 16 or 64 readings of each pin for 1, 2 or 3 extra bits, so values
+ *   run up to 2047, 4095 or 8191.  Each extra bit makes every pin update
+ *   four times less often.
+ *  It can handle up to 16 pins, or #define ANALOG_SAMPLER_MAX_PINS to change that.
+ *
+ *   NOTE: Don't call analogRead() once the sampler is started - they both want the ADC.
+ */
+
+#ifndef ANALOG_SAMPLER_H
+#define ANALOG_SAMPLER_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#ifndef ANALOG_OVERSAMPLE_BITS
+  #define ANALOG_OVERSAMPLE_BITS 0
+#endif
+#if ANALOG_OVERSAMPLE_BITS > 3
+  #error "ANALOG_OVERSAMPLE_BITS can be at most 3"
+#endif
+
+#ifndef ANALOG_SAMPLER_MAX_PINS
+  #define ANALOG_SAMPLER_MAX_PINS 16
+#endif
+
+// How many readings get added up for each value
+#define ANALOG_SAMPLES_PER_VALUE (1 << (2 * ANALOG_OVERSAMPLE_BITS))
+
+  // The ADC channel for each pin in the list
+  uint8_t analogSamplerChannels[ANALOG_SAMPLER_MAX_PINS];
+  uint8_t analogSamplerPinCount = 0;
+  // The newest value for each pin in the list
+  volatile uint16_t analogSamples[ANALOG_SAMPLER_MAX_PINS];
+
+  // These belong to the interrupt
+  uint8_t analogSamplerIndex;
+  uint8_t analogSamplerReadings;
+  uint16_t analogSamplerSum;
+
+  // Points the ADC at a channel, the same way analogRead() does
+  static inline void selectAnalogSamplerChannel(uint8_t channel){
+    #if defined(ADCSRB) && defined(MUX5)
+      ADCSRB = (ADCSRB & ~(1 << MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+    #endif
+    ADMUX = (1 << REFS0) | (channel & 0x07);
+  }
+
+  void startAnalogSampler(const uint8_t* pins, uint8_t pinCount){
+    if (pinCount > ANALOG_SAMPLER_MAX_PINS)
+      pinCount = ANALOG_SAMPLER_MAX_PINS;
+    // Stop the ADC while we change things
+    ADCSRA = 0;
+    for (uint8_t i = 0; i < pinCount; i++){
+      uint8_t pin = pins[i];
+      // Allow for channel or pin numbers, like analogRead() does
+      #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+        if (pin >= 54) pin -= 54;
+      #elif defined(__AVR_ATmega32U4__)
+        if (pin >= 18) pin -= 18;
+        pin = analogPinToChannel(pin);
+      #else
+        if (pin >= 14) pin -= 14;
+      #endif
+      analogSamplerChannels[i] = pin;
+      // Start everything centered until the first real value comes in
+      analogSamples[i] = 512 << ANALOG_OVERSAMPLE_BITS;
+    }
+    analogSamplerPinCount = pinCount;
+    if (pinCount == 0)
+      return;
+    analogSamplerIndex = 0;
+    analogSamplerReadings = 0;
+    analogSamplerSum = 0;
+    selectAnalogSamplerChannel(analogSamplerChannels[0]);
+    // Turn on the ADC and its interrupt, with the same /128 clock analogRead() uses,
+    //  and start the first conversion
+    ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+  }
+
+  // Returns the newest value for the pin at that spot in your list.
+  //  The interrupt can change a value while we're halfway through
+  //  reading its two bytes, so we read until we get the same thing twice.
+  uint16_t getAnalogSample(uint8_t index){
+    uint16_t value;
+    do {
+      value = analogSamples[index];
+    } while (value != analogSamples[index]);
+    return value;
+  }
+
+  // Every time a conversion finishes, add it to the total for this pin,
+  //  and once there are enough readings, store the value and move on
+  //  to the next pin.
+  // We switch channels before starting the next conversion ourselves,
+  //  rather than letting the ADC free-run, so no reading is ever taken
+  //  halfway through a channel change and none have to be thrown away.
+  ISR(ADC_vect){
+    analogSamplerSum += ADC;
+    if (++analogSamplerReadings == ANALOG_SAMPLES_PER_VALUE){
+      analogSamples[analogSamplerIndex] = analogSamplerSum >> ANALOG_OVERSAMPLE_BITS;
+      analogSamplerSum = 0;
+      analogSamplerReadings = 0;
+      if (++analogSamplerIndex >= analogSamplerPinCount)
+        analogSamplerIndex = 0;
+      selectAnalogSamplerChannel(analogSamplerChannels[analogSamplerIndex]);
+    }
+    ADCSRA |= (1 << ADSC);
+  }
+
+#endif
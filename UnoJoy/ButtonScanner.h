@@ -0,0 +1,153 @@
+/*  ButtonScanner.h
+ *
+ *  Reads a whole set of buttons at once, straight from the port
+ *   registers, instead of calling digitalRead() once per pin.
+ *  digitalRead() looks the pin up in three tables and turns interrupts
+ *   off and on again every time you call it.  This reads each port that
+ *   has a button on it once, then tests one bit per button, and the
+ *   pin-to-port lookups all happen when the sketch is compiled.
+ *
+ *  It knows the pin layouts of the Uno (and anything else with an ATmega328),
+ *   the Mega 2560 and the Leonardo.
+ *
+ *   === How to use this file ===
+ *  Add this file to your sketch the same way you add UnoJoy.h, then list
+ *   your buttons as pin and button bit pairs, like this:
+ *
+ *   #define MY_BUTTONS(BUTTON) \
+ *     BUTTON(2, UNOJOY_TRIANGLE) \
+ *     BUTTON(3, UNOJOY_CIRCLE) \
+ *     BUTTON(A4, UNOJOY_START)
+ *
+ *  The button bit is which bit of your controller data that pin sets -
+ *   for UnoJoy and LeoJoy that's one of the UNOJOY_ button names, and for
+ *   MegaJoy it's the button number, counting from 0.
+ *  Then, in getControllerData(), instead of all the digitalRead() calls, do
+ *
+ *   scanButtonPins(MY_BUTTONS, (uint8_t*)&controllerData);
+ *
+ *  or, for MegaJoy,
+ *
+ *   scanButtonPins(MY_BUTTONS, controllerData.buttonArray);
+ *
+ *  Buttons are wired to ground with the pull-ups on, the same as the
+ *   sample sketches, so a pin that reads low sets its bit.  Bits for
+ *   buttons that aren't pressed are left alone, so start from
+ *   getBlankDataForController().
+ *  The pins need to be numbers the compiler can see, not variables, or the
+ *   lookups happen while the sketch runs instead.
+ */
+
+#ifndef BUTTON_SCANNER_H
+#define BUTTON_SCANNER_H
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Each pin is stored as (port << 3) | bit, with the ports numbered
+//  in the order readButtonPorts() reads them in.
+#define SCAN_PIN(port, bit) (((port) << 3) | (bit))
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+
+  enum { SCAN_PA, SCAN_PB, SCAN_PC, SCAN_PD, SCAN_PE, SCAN_PF,
+         SCAN_PG, SCAN_PH, SCAN_PJ, SCAN_PK, SCAN_PL, SCAN_PORT_COUNT };
+
+  static const uint8_t scanPinTable[70] = {
+    SCAN_PIN(SCAN_PE, 0), SCAN_PIN(SCAN_PE, 1), SCAN_PIN(SCAN_PE, 4), SCAN_PIN(SCAN_PE, 5),	// D0 - D3
+    SCAN_PIN(SCAN_PG, 5), SCAN_PIN(SCAN_PE, 3), SCAN_PIN(SCAN_PH, 3), SCAN_PIN(SCAN_PH, 4),	// D4 - D7
+    SCAN_PIN(SCAN_PH, 5), SCAN_PIN(SCAN_PH, 6), SCAN_PIN(SCAN_PB, 4), SCAN_PIN(SCAN_PB, 5),	// D8 - D11
+    SCAN_PIN(SCAN_PB, 6), SCAN_PIN(SCAN_PB, 7), SCAN_PIN(SCAN_PJ, 1), SCAN_PIN(SCAN_PJ, 0),	// D12 - D15
+    SCAN_PIN(SCAN_PH, 1), SCAN_PIN(SCAN_PH, 0), SCAN_PIN(SCAN_PD, 3), SCAN_PIN(SCAN_PD, 2),	// D16 - D19
+    SCAN_PIN(SCAN_PD, 1), SCAN_PIN(SCAN_PD, 0),						// D20 - D21
+    SCAN_PIN(SCAN_PA, 0), SCAN_PIN(SCAN_PA, 1), SCAN_PIN(SCAN_PA, 2), SCAN_PIN(SCAN_PA, 3),	// D22 - D25
+    SCAN_PIN(SCAN_PA, 4), SCAN_PIN(SCAN_PA, 5), SCAN_PIN(SCAN_PA, 6), SCAN_PIN(SCAN_PA, 7),	// D26 - D29
+    SCAN_PIN(SCAN_PC, 7), SCAN_PIN(SCAN_PC, 6), SCAN_PIN(SCAN_PC, 5), SCAN_PIN(SCAN_PC, 4),	// D30 - D33
+    SCAN_PIN(SCAN_PC, 3), SCAN_PIN(SCAN_PC, 2), SCAN_PIN(SCAN_PC, 1), SCAN_PIN(SCAN_PC, 0),	// D34 - D37
+    SCAN_PIN(SCAN_PD, 7), SCAN_PIN(SCAN_PG, 2), SCAN_PIN(SCAN_PG, 1), SCAN_PIN(SCAN_PG, 0),	// D38 - D41
+    SCAN_PIN(SCAN_PL, 7), SCAN_PIN(SCAN_PL, 6), SCAN_PIN(SCAN_PL, 5), SCAN_PIN(SCAN_PL, 4),	// D42 - D45
+    SCAN_PIN(SCAN_PL, 3), SCAN_PIN(SCAN_PL, 2), SCAN_PIN(SCAN_PL, 1), SCAN_PIN(SCAN_PL, 0),	// D46 - D49
+    SCAN_PIN(SCAN_PB, 3), SCAN_PIN(SCAN_PB, 2), SCAN_PIN(SCAN_PB, 1), SCAN_PIN(SCAN_PB, 0),	// D50 - D53
+    SCAN_PIN(SCAN_PF, 0), SCAN_PIN(SCAN_PF, 1), SCAN_PIN(SCAN_PF, 2), SCAN_PIN(SCAN_PF, 3),	// A0 - A3
+    SCAN_PIN(SCAN_PF, 4), SCAN_PIN(SCAN_PF, 5), SCAN_PIN(SCAN_PF, 6), SCAN_PIN(SCAN_PF, 7),	// A4 - A7
+    SCAN_PIN(SCAN_PK, 0), SCAN_PIN(SCAN_PK, 1), SCAN_PIN(SCAN_PK, 2), SCAN_PIN(SCAN_PK, 3),	// A8 - A11
+    SCAN_PIN(SCAN_PK, 4), SCAN_PIN(SCAN_PK, 5), SCAN_PIN(SCAN_PK, 6), SCAN_PIN(SCAN_PK, 7)	// A12 - A15
+  };
+
+  static inline void readButtonPorts(uint8_t* ports, uint16_t used){
+    if (used & (1 << SCAN_PA)) ports[SCAN_PA] = ~PINA;
+    if (used & (1 << SCAN_PB)) ports[SCAN_PB] = ~PINB;
+    if (used & (1 << SCAN_PC)) ports[SCAN_PC] = ~PINC;
+    if (used & (1 << SCAN_PD)) ports[SCAN_PD] = ~PIND;
+    if (used & (1 << SCAN_PE)) ports[SCAN_PE] = ~PINE;
+    if (used & (1 << SCAN_PF)) ports[SCAN_PF] = ~PINF;
+    if (used & (1 << SCAN_PG)) ports[SCAN_PG] = ~PING;
+    if (used & (1 << SCAN_PH)) ports[SCAN_PH] = ~PINH;
+    if (used & (1 << SCAN_PJ)) ports[SCAN_PJ] = ~PINJ;
+    if (used & (1 << SCAN_PK)) ports[SCAN_PK] = ~PINK;
+    if (used & (1 << SCAN_PL)) ports[SCAN_PL] = ~PINL;
+  }
+
+#elif defined(__AVR_ATmega32U4__)
+
+  enum { SCAN_PB, SCAN_PC, SCAN_PD, SCAN_PE, SCAN_PF, SCAN_PORT_COUNT };
+
+  static const uint8_t scanPinTable[24] = {
+    SCAN_PIN(SCAN_PD, 2), SCAN_PIN(SCAN_PD, 3), SCAN_PIN(SCAN_PD, 1), SCAN_PIN(SCAN_PD, 0),	// D0 - D3
+    SCAN_PIN(SCAN_PD, 4), SCAN_PIN(SCAN_PC, 6), SCAN_PIN(SCAN_PD, 7), SCAN_PIN(SCAN_PE, 6),	// D4 - D7
+    SCAN_PIN(SCAN_PB, 4), SCAN_PIN(SCAN_PB, 5), SCAN_PIN(SCAN_PB, 6), SCAN_PIN(SCAN_PB, 7),	// D8 - D11
+    SCAN_PIN(SCAN_PD, 6), SCAN_PIN(SCAN_PC, 7), SCAN_PIN(SCAN_PB, 3), SCAN_PIN(SCAN_PB, 1),	// D12 - D15
+    SCAN_PIN(SCAN_PB, 2), SCAN_PIN(SCAN_PB, 0),						// D16 - D17
+    SCAN_PIN(SCAN_PF, 7), SCAN_PIN(SCAN_PF, 6), SCAN_PIN(SCAN_PF, 5), SCAN_PIN(SCAN_PF, 4),	// A0 - A3
+    SCAN_PIN(SCAN_PF, 1), SCAN_PIN(SCAN_PF, 0)						// A4 - A5
+  };
+
+  static inline void readButtonPorts(uint8_t* ports, uint16_t used){
+    if (used & (1 << SCAN_PB)) ports[SCAN_PB] = ~PINB;
+    if (used & (1 << SCAN_PC)) ports[SCAN_PC] = ~PINC;
+    if (used & (1 << SCAN_PD)) ports[SCAN_PD] = ~PIND;
+    if (used & (1 << SCAN_PE)) ports[SCAN_PE] = ~PINE;
+    if (used & (1 << SCAN_PF)) ports[SCAN_PF] = ~PINF;
+  }
+
+#else	// The Uno, and the other ATmega328 and 168 boards
+
+  enum { SCAN_PB, SCAN_PC, SCAN_PD, SCAN_PORT_COUNT };
+
+  static const uint8_t scanPinTable[20] = {
+    SCAN_PIN(SCAN_PD, 0), SCAN_PIN(SCAN_PD, 1), SCAN_PIN(SCAN_PD, 2), SCAN_PIN(SCAN_PD, 3),	// D0 - D3
+    SCAN_PIN(SCAN_PD, 4), SCAN_PIN(SCAN_PD, 5), SCAN_PIN(SCAN_PD, 6), SCAN_PIN(SCAN_PD, 7),	// D4 - D7
+    SCAN_PIN(SCAN_PB, 0), SCAN_PIN(SCAN_PB, 1), SCAN_PIN(SCAN_PB, 2), SCAN_PIN(SCAN_PB, 3),	// D8 - D11
+    SCAN_PIN(SCAN_PB, 4), SCAN_PIN(SCAN_PB, 5),						// D12 - D13
+    SCAN_PIN(SCAN_PC, 0), SCAN_PIN(SCAN_PC, 1), SCAN_PIN(SCAN_PC, 2), SCAN_PIN(SCAN_PC, 3),	// A0 - A3
+    SCAN_PIN(SCAN_PC, 4), SCAN_PIN(SCAN_PC, 5)						// A4 - A5
+  };
+
+  static inline void readButtonPorts(uint8_t* ports, uint16_t used){
+    if (used & (1 << SCAN_PB)) ports[SCAN_PB] = ~PINB;
+    if (used & (1 << SCAN_PC)) ports[SCAN_PC] = ~PINC;
+    if (used & (1 << SCAN_PD)) ports[SCAN_PD] = ~PIND;
+  }
+
+#endif
+
+#define scanPinPort(pin) (scanPinTable[pin] >> 3)
+#define scanPinMask(pin) (1 << (scanPinTable[pin] & 7))
+
+// Used by scanButtonPins() to go over your button list twice - once to
+//  find out which ports it needs to read, and once to test each pin
+#define SCAN_PORT_USED(pin, button) | (1 << scanPinPort(pin))
+#define SCAN_BUTTON(pin, button) \
+  if (_scanPorts[scanPinPort(pin)] & scanPinMask(pin)) \
+    _scanButtons[(button) >> 3] |= 1 << ((button) & 7);
+
+// Reads every port in one go, so all the buttons come from the same moment,
+//  then sets the bit for each pressed button in buttonBytes
+#define scanButtonPins(BUTTON_LIST, buttonBytes) do { \
+    uint8_t _scanPorts[SCAN_PORT_COUNT]; \
+    uint8_t* _scanButtons = (buttonBytes); \
+    readButtonPorts(_scanPorts, 0 BUTTON_LIST(SCAN_PORT_USED)); \
+    BUTTON_LIST(SCAN_BUTTON) \
+  } while (0)
+
+#endif
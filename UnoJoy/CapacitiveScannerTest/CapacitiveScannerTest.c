@@ -0,0 +1,267 @@
+/*  CapacitiveScannerTest.c
+ *
+ *  This checks CapacitiveScanner.h on a PC, so you can change it without
+ *   wiring up pads and poking at them every time.
+ *  The hostArduino folder has a stand-in for Arduino.h, with an Uno's pins
+ *   and its port registers as ordinary bytes.  Instead of reading a real
+ *   port, the scanner asks fakePort() below, which brings each pad up after
+ *   however many counts the test has set for it.  It can also make a scan
+ *   run long, like an interrupt landing in the middle of it does on the
+ *   real thing - every pad that hasn't come up yet reads late by the same
+ *   amount.
+ *  It checks which pads end up on which ports, the baselines, that a single
+ *   long scan doesn't count as a touch but two do, letting go, the baseline
+ *   following a pad, a pad with nothing plugged in, and the 16th pad.
+ *
+ *  To build it:
+ *      gcc -Wall -Wextra -I hostArduino -o CapacitiveScannerTest CapacitiveScannerTest.c
+ *
+ *  To use it:
+ *      ./CapacitiveScannerTest        (prints each check, and any problems)
+ *  It exits with 0 if everything was right, or 1 if anything wasn't.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Arduino.h>
+
+// A pad that never comes up, like one with nothing plugged in
+#define NEVER 0xFFFF
+
+// How many counts each pin takes to come up
+uint16_t riseCounts[20];
+// How many port scans in a row run long, and by how much
+uint8_t longScans = 0;
+uint16_t longBy = 0;
+uint16_t longNow = 0;
+
+static uint8_t pinOnPort(uint8_t port, uint8_t bit){
+	if (port == PD)
+		return bit;
+	if (port == PB)
+		return bit + 8;
+	return bit + 14;
+}
+
+// Reads a fake port - every pad that's been let go and
+//  has had long enough to come up reads high
+static uint8_t fakePort(volatile uint8_t* input, uint16_t count){
+	uint8_t port = input - hostPIN;
+	uint8_t value = 0;
+	// A new scan of this port, so see if it's one of the long ones
+	if (count == 0){
+		longNow = 0;
+		if (longScans){
+			longScans--;
+			longNow = longBy;
+		}
+	}
+	for (uint8_t bit = 0; bit < 8; bit++){
+		uint8_t pin = pinOnPort(port, bit);
+		if (pin >= 20 || (hostDDR[port] & (1 << bit)))
+			continue;
+		if (riseCounts[pin] != NEVER && riseCounts[pin] + longNow <= count)
+			value |= 1 << bit;
+	}
+	return value;
+}
+
+#define CAPACITIVE_READ_PORT(port, count) fakePort((port)->input, count)
+
+// The library itself, built for the PC
+#include "../CapacitiveScanner.h"
+
+int problems = 0;
+
+void expect(const char* what, long got, long expected){
+	if (got != expected){
+		printf("    %s: got %ld, expected %ld\n", what, got, expected);
+		problems++;
+	}
+}
+
+void expectNear(const char* what, long got, long expected, long slack){
+	if (labs(got - expected) > slack){
+		printf("    %s: got %ld, expected %ld give or take %ld\n", what, got, expected, slack);
+		problems++;
+	}
+}
+
+void setRises(uint16_t count){
+	for (uint8_t pin = 0; pin < 20; pin++)
+		riseCounts[pin] = count;
+}
+
+void testSetup(void){
+	printf("setup\n");
+	const uint8_t pins[] = {2, 3, 4, 5, 8, 9};
+	setRises(40);
+	hostPORT[PD] = 0xFF;
+	setupCapacitivePads(pins, 6);
+	expect("pads", capacitivePadCount, 6);
+	expect("ports", capacitivePortCount, 2);
+	expect("PORTD pads", capacitivePorts[0].mask, 0x3C);
+	expect("PORTB pads", capacitivePorts[1].mask, 0x03);
+	expect("pin 4's pad", capacitivePorts[0].padForBit[4], 2);
+	expect("pin 9's pad", capacitivePorts[1].padForBit[1], 5);
+	// The pads are left held low, and nothing else on the port is touched
+	expect("PORTD outputs", hostPORT[PD], 0xC3);
+	expect("PORTD modes", hostDDR[PD], 0x3C);
+	expect("PORTB modes", hostDDR[PB], 0x03);
+	for (uint8_t pad = 0; pad < 6; pad++)
+		expect("baseline", capacitiveBaselines[pad], 40 << 4);
+
+	// The same pin twice only gets scanned once
+	const uint8_t twice[] = {2, 2, 3};
+	setupCapacitivePads(twice, 3);
+	expect("repeated pin, ports", capacitivePortCount, 1);
+	expect("repeated pin, PORTD pads", capacitivePorts[0].mask, 0x0C);
+	expect("repeated pin, pin 3's pad", capacitivePorts[0].padForBit[3], 2);
+}
+
+void testCalibration(void){
+	printf("calibration\n");
+	const uint8_t pins[] = {2, 3, 8};
+	setRises(40);
+	riseCounts[8] = 60;
+	// An interrupt during setup mustn't end up in the baseline
+	longScans = 1;
+	longBy = 125;
+	setupCapacitivePads(pins, 3);
+	expect("pin 2 baseline", capacitiveBaselines[0], 40 << 4);
+	expect("pin 8 baseline", capacitiveBaselines[2], 60 << 4);
+	expect("touched", capacitiveTouched, 0);
+}
+
+void testTouch(void){
+	printf("touch\n");
+	const uint8_t pins[] = {2, 3, 4, 8};
+	setRises(40);
+	setupCapacitivePads(pins, 4);
+	for (uint8_t i = 0; i < 10; i++)
+		scanCapacitivePads();
+	expect("resting", capacitiveTouched, 0);
+
+	// About 1500 cycles of interrupt, at 12 cycles a count,
+	//  makes one scan of PORTD long for every pad on it
+	longScans = 1;
+	longBy = 125;
+	scanCapacitivePads();
+	expect("one long scan", capacitiveTouched, 0);
+	expect("one long scan, reading", capacitiveReadings[0], 165);
+	scanCapacitivePads();
+	expect("after one long scan", capacitiveTouched, 0);
+	expect("after one long scan, baseline", capacitiveBaselines[0], 40 << 4);
+
+	// Long scans with a normal one in between don't add up
+	for (uint8_t i = 0; i < 5; i++){
+		longScans = 1;
+		scanCapacitivePads();
+		scanCapacitivePads();
+	}
+	expect("every other scan long", capacitiveTouched, 0);
+
+	// A real touch takes two scans
+	riseCounts[3] = 60;
+	scanCapacitivePads();
+	expect("first touched scan", capacitiveTouched, 0);
+	scanCapacitivePads();
+	expect("second touched scan", capacitiveTouched, 0x02);
+	expect("pad 1", capacitivePadTouched(1), 1);
+	expect("pad 0", capacitivePadTouched(0), 0);
+
+	// Holding on doesn't move the baseline
+	for (uint8_t i = 0; i < 50; i++)
+		scanCapacitivePads();
+	expect("held, baseline", capacitiveBaselines[1], 40 << 4);
+	expect("held", capacitiveTouched, 0x02);
+
+	// It lets go once it's back under an eighth over, not a quarter
+	riseCounts[3] = 47;
+	scanCapacitivePads();
+	expect("between the thresholds", capacitiveTouched, 0x02);
+	riseCounts[3] = 44;
+	scanCapacitivePads();
+	expect("let go", capacitiveTouched, 0);
+}
+
+void testBaseline(void){
+	printf("baseline\n");
+	const uint8_t pins[] = {2, 3};
+	setRises(40);
+	setupCapacitivePads(pins, 2);
+	// A pad that creeps up without being touched gets followed
+	riseCounts[2] = 48;
+	for (uint8_t i = 0; i < 100; i++)
+		scanCapacitivePads();
+	expect("crept up", capacitiveTouched, 0);
+	expectNear("followed", capacitiveBaselines[0], 48 << 4, 16);
+	expect("other pad", capacitiveBaselines[1], 40 << 4);
+	// So the threshold moves with it
+	riseCounts[2] = 58;
+	scanCapacitivePads();
+	scanCapacitivePads();
+	expect("over the old threshold", capacitiveTouched, 0);
+	riseCounts[2] = 62;
+	scanCapacitivePads();
+	scanCapacitivePads();
+	expect("over the new threshold", capacitiveTouched, 0x01);
+}
+
+void testNothingPlugged(void){
+	printf("nothing plugged in\n");
+	expect("max count", CAPACITIVE_MAX_COUNT, 333);
+	const uint8_t pins[] = {2, 3};
+	setRises(40);
+	riseCounts[3] = NEVER;
+	setupCapacitivePads(pins, 2);
+	expect("reading", capacitiveReadings[1], CAPACITIVE_MAX_COUNT);
+	expect("baseline", capacitiveBaselines[1], CAPACITIVE_MAX_COUNT << 4);
+	expect("the other pad", capacitiveReadings[0], 40);
+	for (uint8_t i = 0; i < 10; i++)
+		scanCapacitivePads();
+	expect("touched", capacitiveTouched, 0);
+}
+
+void testSixteenPads(void){
+	printf("sixteen pads\n");
+	uint8_t pins[16];
+	for (uint8_t pad = 0; pad < 16; pad++)
+		pins[pad] = pad;
+	setRises(40);
+	setupCapacitivePads(pins, 16);
+	expect("pads", capacitivePadCount, 16);
+	expect("ports", capacitivePortCount, 3);
+	riseCounts[15] = 60;
+	scanCapacitivePads();
+	scanCapacitivePads();
+	expect("touched", capacitiveTouched, 0x8000);
+	expect("pad 15", capacitivePadTouched(15), 1);
+	riseCounts[15] = 40;
+	scanCapacitivePads();
+	expect("let go", capacitiveTouched, 0);
+}
+
+int main(void){
+	testSetup();
+	testCalibration();
+	testTouch();
+	testBaseline();
+	testNothingPlugged();
+	testSixteenPads();
+	printf("\n%d problems\n", problems);
+	return problems ? 1 : 0;
+}
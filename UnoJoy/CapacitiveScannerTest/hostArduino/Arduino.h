@@ -0,0 +1,47 @@
+/*  hostArduino/Arduino.h
+ *
+ *  Just enough of Arduino.h for CapacitiveScanner.h on a PC.  The pins are
+ *   laid out like an Uno - 0 to 7 on PORTD, 8 to 13 on PORTB, and 14 to 19
+ *   (A0 to A5) on PORTC - and each port's registers are ordinary bytes the
+ *   test can look at.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+
+#define F_CPU 16000000UL
+
+#define PB 2
+#define PC 3
+#define PD 4
+#define HOST_PORTS 5
+
+static volatile uint8_t hostPIN[HOST_PORTS];
+static volatile uint8_t hostDDR[HOST_PORTS];
+static volatile uint8_t hostPORT[HOST_PORTS];
+
+#define portInputRegister(port) (&hostPIN[port])
+#define portModeRegister(port) (&hostDDR[port])
+#define portOutputRegister(port) (&hostPORT[port])
+
+static uint8_t digitalPinToPort(uint8_t pin){
+	if (pin < 8)
+		return PD;
+	if (pin < 14)
+		return PB;
+	return PC;
+}
+
+static uint8_t digitalPinToBitMask(uint8_t pin){
+	if (pin < 8)
+		return 1 << pin;
+	if (pin < 14)
+		return 1 << (pin - 8);
+	return 1 << (pin - 14);
+}
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#endif
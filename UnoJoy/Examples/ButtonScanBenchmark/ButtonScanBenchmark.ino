@@ -0,0 +1,89 @@
+/*  ButtonScanBenchmark
+ *
+ *  Times reading the sample sketch's 13 buttons with digitalRead()
+ *   against reading them with scanButtonPins() from ButtonScanner.h,
+ *   and prints how long each takes.
+ *
+ *  Run this with the board in normal Arduino mode (TurnIntoAnArduino),
+ *   and open the Serial Monitor at 38400.  It works on the Uno, the Mega
+ *   and the Leonardo.
+ */
+#include "ButtonScanner.h"
+
+#define SCANS 1000
+
+// The same wiring as UnoJoyArduinoSample, as button bit numbers
+//  (triangle is 0, circle is 1, and so on, like UnoJoy.h's UNOJOY_ names)
+#define SAMPLE_BUTTONS(BUTTON) \
+  BUTTON(2, 0)    /* triangle */ \
+  BUTTON(3, 1)    /* circle */ \
+  BUTTON(4, 2)    /* square */ \
+  BUTTON(5, 3)    /* cross */ \
+  BUTTON(6, 14)   /* up */ \
+  BUTTON(7, 16)   /* down */ \
+  BUTTON(8, 13)   /* left */ \
+  BUTTON(9, 15)   /* right */ \
+  BUTTON(10, 4)   /* l1 */ \
+  BUTTON(11, 7)   /* r1 */ \
+  BUTTON(12, 10)  /* select */ \
+  BUTTON(A4, 11)  /* start */ \
+  BUTTON(A5, 12)  /* home */
+
+// Somewhere to put the results, so the compiler can't skip the work
+volatile uint8_t result[3];
+
+void setup(){
+  for (int i = 2; i <= 12; i++){
+    pinMode(i, INPUT);
+    digitalWrite(i, HIGH);
+  }
+  pinMode(A4, INPUT);
+  digitalWrite(A4, HIGH);
+  pinMode(A5, INPUT);
+  digitalWrite(A5, HIGH);
+  Serial.begin(38400);
+}
+
+void loop(){
+  uint8_t buttons[3];
+  unsigned long start;
+  unsigned long withDigitalRead;
+  unsigned long withScanner;
+
+  start = micros();
+  for (int i = 0; i < SCANS; i++){
+    buttons[0] = buttons[1] = buttons[2] = 0;
+    buttons[0] |= (!digitalRead(2)) << 0;
+    buttons[0] |= (!digitalRead(3)) << 1;
+    buttons[0] |= (!digitalRead(4)) << 2;
+    buttons[0] |= (!digitalRead(5)) << 3;
+    buttons[1] |= (!digitalRead(6)) << 6;
+    buttons[2] |= (!digitalRead(7)) << 0;
+    buttons[1] |= (!digitalRead(8)) << 5;
+    buttons[1] |= (!digitalRead(9)) << 7;
+    buttons[0] |= (!digitalRead(10)) << 4;
+    buttons[0] |= (!digitalRead(11)) << 7;
+    buttons[1] |= (!digitalRead(12)) << 2;
+    buttons[1] |= (!digitalRead(A4)) << 3;
+    buttons[1] |= (!digitalRead(A5)) << 4;
+    result[0] = buttons[0]; result[1] = buttons[1]; result[2] = buttons[2];
+  }
+  withDigitalRead = micros() - start;
+
+  start = micros();
+  for (int i = 0; i < SCANS; i++){
+    buttons[0] = buttons[1] = buttons[2] = 0;
+    scanButtonPins(SAMPLE_BUTTONS, buttons);
+    result[0] = buttons[0]; result[1] = buttons[1]; result[2] = buttons[2];
+  }
+  withScanner = micros() - start;
+
+  // The loop and the micros() calls are counted in both, so this is
+  //  a little slow for each, but the difference between them is real
+  Serial.print("digitalRead: ");
+  Serial.print(withDigitalRead * (F_CPU / 1000000L) / SCANS);
+  Serial.print(" cycles per scan, scanButtonPins: ");
+  Serial.print(withScanner * (F_CPU / 1000000L) / SCANS);
+  Serial.println(" cycles per scan");
+  delay(1000);
+}
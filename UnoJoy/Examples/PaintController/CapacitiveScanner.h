@@ -0,0 +1,244 @@
+/*  CapacitiveScanner.h
+ *
+ *  Reads a whole set of capacitive touch pads at once.
+ *  Each pad needs a beefy (1 Megaohm or so) resistor pulling it up to +5v.
+ *   To read a pad, we hold it low, let go, and count how long it takes
+ *   to get pulled back up - the more capacitance there is on it (like
+ *   when you touch it), the longer that takes.
+ *  Instead of doing that one pin at a time, with a delay(1) each, this
+ *   lets go of every pad on a port together and watches the whole port,
+ *   so all the pads on it are timed in the same go.  The pads are kept
+ *   held low in between scans, so they're already discharged and there's
+ *   nothing to wait for.  Scanning a dozen pads takes a fraction of a
+ *   millisecond instead of more than ten.
+ *
+ *  It also keeps a baseline reading for each pad, which slowly follows the
+ *   pad while it's not being touched, so changes in humidity or where the
+ *   cable is lying don't get mistaken for touches.
+ *  There's a test that runs this on a PC in UnoJoy/CapacitiveScannerTest.
+ *
+ *   === How to use this file ===
+ *  Add this file to your sketch, then in setup() give it your pads:
+ *
+ *   const uint8_t padPins[] = {2, 3, 4, 5};
+ *   setupCapacitivePads(padPins, 4);
+ *
+ *  That also takes the first baselines, so don't touch the pads while it starts.
+ *  Then in getControllerData() do
+ *
+ *   scanCapacitivePads();
+ *   controllerData.crossOn = capacitivePadTouched(0);
+ *
+ *  where the number is where the pad is in your list.  capacitiveReadings[]
+ *   holds the raw reading for each pad, if you want to see them.
+ *
+ *  A pad counts as touched once it reads a quarter more than its baseline
+ *   two scans in a row, and as let go once it drops back under an eighth more.
+ *   The timing runs with interrupts on, so serial bytes don't get dropped,
+ *   and an interrupt that lands in the middle of a scan makes every pad that
+ *   was still coming up read long - waiting for a second scan keeps that
+ *   from turning into a press on all of them at once.
+ *   #define CAPACITIVE_TOUCH_SHIFT before including this file to change that -
+ *   1 is a half, 3 is an eighth, and so on.
+ *  It can handle up to 16 pads on up to 4 ports, or #define CAPACITIVE_MAX_PADS
+ *   and CAPACITIVE_MAX_PORTS to change that.
+ */
+
+#ifndef CAPACITIVE_SCANNER_H
+#define CAPACITIVE_SCANNER_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#ifndef CAPACITIVE_MAX_PADS
+  #define CAPACITIVE_MAX_PADS 16
+#endif
+#ifndef CAPACITIVE_MAX_PORTS
+  #define CAPACITIVE_MAX_PORTS 4
+#endif
+#ifndef CAPACITIVE_TOUCH_SHIFT
+  #define CAPACITIVE_TOUCH_SHIFT 2
+#endif
+// How far the baseline moves towards each reading, as a shift -
+//  4 means it closes a sixteenth of the gap every scan
+#ifndef CAPACITIVE_DRIFT_SHIFT
+  #define CAPACITIVE_DRIFT_SHIFT 4
+#endif
+// How long to wait for a pad on each port before giving up on it, in us.
+//  A sketch with pads on two ports can take twice this when nothing's
+//  plugged in, which still keeps a whole scan well under 1 ms.
+#ifndef CAPACITIVE_TIMEOUT_US
+  #define CAPACITIVE_TIMEOUT_US 250
+#endif
+// Each count of the timing loop is roughly 12 cycles - reading the port,
+//  masking it and counting - so that's this many counts.  At 16 MHz, that's
+//  333 counts of about 0.75 us each.
+#ifndef CAPACITIVE_MAX_COUNT
+  #define CAPACITIVE_MAX_COUNT ((uint16_t)((F_CPU / 1000000UL) * CAPACITIVE_TIMEOUT_US / 12))
+#endif
+// Reads the pads on a port.  count is how long we've waited so far -
+//  the test on the PC uses it to fake pads coming up, and here it's ignored.
+#ifndef CAPACITIVE_READ_PORT
+  #define CAPACITIVE_READ_PORT(port, count) (*(port)->input)
+#endif
+
+  typedef struct capacitivePort_t
+  {
+    volatile uint8_t* input;
+    volatile uint8_t* mode;
+    volatile uint8_t* output;
+    uint8_t mask;           // Which bits of the port have pads on them
+    uint8_t padForBit[8];   // Which pad is on each of those bits
+  } capacitivePort_t;
+
+  capacitivePort_t capacitivePorts[CAPACITIVE_MAX_PORTS];
+  uint8_t capacitivePortCount = 0;
+  uint8_t capacitivePadCount = 0;
+
+  // The newest reading from each pad
+  uint16_t capacitiveReadings[CAPACITIVE_MAX_PADS];
+  // Each pad's baseline, in sixteenths of a count
+  uint16_t capacitiveBaselines[CAPACITIVE_MAX_PADS];
+  // One bit per pad, set while it's touched
+  uint16_t capacitiveTouched = 0;
+  // One bit per pad, set if it read over the touch threshold last scan
+  uint16_t capacitiveOver = 0;
+
+  // Times every pad on one port.  They're all held low when we get here.
+  static void scanCapacitivePort(capacitivePort_t* port){
+    uint8_t mask = port->mask;
+    uint8_t seen = 0;
+    uint16_t count = 0;
+    // Let go of all the pads together.  Their output bits are low,
+    //  so they become inputs without the internal pull-up.
+    *port->mode &= ~mask;
+    // Then watch the whole port, noting when each pad comes up
+    do {
+      uint8_t risen = CAPACITIVE_READ_PORT(port, count) & mask & ~seen;
+      if (risen){
+        seen |= risen;
+        for (uint8_t bit = 0; risen; bit++, risen >>= 1){
+          if (risen & 1)
+            capacitiveReadings[port->padForBit[bit]] = count;
+        }
+      }
+    } while (seen != mask && ++count < CAPACITIVE_MAX_COUNT);
+    // Any that never came up get the longest reading
+    for (uint8_t bit = 0, late = mask & ~seen; late; bit++, late >>= 1){
+      if (late & 1)
+        capacitiveReadings[port->padForBit[bit]] = CAPACITIVE_MAX_COUNT;
+    }
+    // Discharge them all again, and leave them held low.
+    //  It's important to leave the pins low if you want to
+    //  be able to touch more than 1 sensor at a time - if
+    //  the sensor is left pulled high, when you touch
+    //  two sensors, your body will transfer the charge between
+    //  sensors.
+    *port->output &= ~mask;
+    *port->mode |= mask;
+  }
+
+  // Reads every pad, and updates which ones are touched
+  //  and the baselines of the ones that aren't
+  void scanCapacitivePads(void){
+    for (uint8_t i = 0; i < capacitivePortCount; i++)
+      scanCapacitivePort(&capacitivePorts[i]);
+
+    for (uint8_t pad = 0; pad < capacitivePadCount; pad++){
+      uint16_t reading = capacitiveReadings[pad] << 4;
+      uint16_t baseline = capacitiveBaselines[pad];
+      uint16_t threshold = baseline >> CAPACITIVE_TOUCH_SHIFT;
+      uint16_t padBit = (uint16_t)1 << pad;
+      // Don't let a tiny baseline make every little flicker a touch
+      if (threshold < (2 << 4))
+        threshold = 2 << 4;
+      if (capacitiveTouched & padBit){
+        if (reading < baseline + threshold / 2)
+          capacitiveTouched &= ~padBit;
+      }
+      else if (reading > baseline + threshold){
+        // One long reading could just be an interrupt, so it
+        //  takes two in a row to count as a touch
+        if (capacitiveOver & padBit)
+          capacitiveTouched |= padBit;
+        capacitiveOver |= padBit;
+        continue;
+      }
+      capacitiveOver &= ~padBit;
+      // Only follow pads that aren't being touched, so a long
+      //  press doesn't slowly become the new baseline
+      if (!(capacitiveTouched & padBit))
+        capacitiveBaselines[pad] = baseline + ((int16_t)(reading - baseline) >> CAPACITIVE_DRIFT_SHIFT);
+    }
+  }
+
+  // Starts the baselines over, from the average of 8 readings.  Each of
+  //  those is the shorter of two scans straight after each other, so an
+  //  interrupt landing in one of them doesn't throw the baseline off.
+  void calibrateCapacitivePads(void){
+    uint16_t totals[CAPACITIVE_MAX_PADS];
+    uint16_t first[CAPACITIVE_MAX_PADS];
+    for (uint8_t pad = 0; pad < capacitivePadCount; pad++)
+      totals[pad] = 0;
+    for (uint8_t i = 0; i < 8; i++){
+      for (uint8_t p = 0; p < capacitivePortCount; p++)
+        scanCapacitivePort(&capacitivePorts[p]);
+      for (uint8_t pad = 0; pad < capacitivePadCount; pad++)
+        first[pad] = capacitiveReadings[pad];
+      for (uint8_t p = 0; p < capacitivePortCount; p++)
+        scanCapacitivePort(&capacitivePorts[p]);
+      for (uint8_t pad = 0; pad < capacitivePadCount; pad++)
+        totals[pad] += min(first[pad], capacitiveReadings[pad]);
+    }
+    // The total of 8 readings, times 2, is the average in sixteenths
+    for (uint8_t pad = 0; pad < capacitivePadCount; pad++)
+      capacitiveBaselines[pad] = totals[pad] * 2;
+    capacitiveTouched = 0;
+    capacitiveOver = 0;
+  }
+
+  void setupCapacitivePads(const uint8_t* pins, uint8_t padCount){
+    if (padCount > CAPACITIVE_MAX_PADS)
+      padCount = CAPACITIVE_MAX_PADS;
+    capacitivePortCount = 0;
+    capacitivePadCount = 0;
+    for (uint8_t pad = 0; pad < padCount; pad++){
+      uint8_t portNumber = digitalPinToPort(pins[pad]);
+      uint8_t bitmask = digitalPinToBitMask(pins[pad]);
+      volatile uint8_t* input = portInputRegister(portNumber);
+      capacitivePort_t* port = 0;
+      // Find this pin's port, or start a new one
+      for (uint8_t i = 0; i < capacitivePortCount; i++){
+        if (capacitivePorts[i].input == input)
+          port = &capacitivePorts[i];
+      }
+      if (!port){
+        if (capacitivePortCount == CAPACITIVE_MAX_PORTS)
+          break;
+        port = &capacitivePorts[capacitivePortCount++];
+        port->input = input;
+        port->mode = portModeRegister(portNumber);
+        port->output = portOutputRegister(portNumber);
+        port->mask = 0;
+      }
+      // The same pin twice would never get its second reading
+      if (port->mask & bitmask)
+        continue;
+      port->mask |= bitmask;
+      for (uint8_t bit = 0; bit < 8; bit++){
+        if (bitmask == (1 << bit))
+          port->padForBit[bit] = pad;
+      }
+      // Hold the pad low until we scan it
+      *port->output &= ~bitmask;
+      *port->mode |= bitmask;
+      capacitivePadCount = pad + 1;
+    }
+    calibrateCapacitivePads();
+  }
+
+  static inline uint8_t capacitivePadTouched(uint8_t pad){
+    return (capacitiveTouched >> pad) & 1;
+  }
+
+#endif
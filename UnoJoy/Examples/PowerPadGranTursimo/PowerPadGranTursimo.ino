@@ -1,5 +1,10 @@
 
 #include "UnoJoy.h"
+// We only have two pads, so one byte of buttons is plenty,
+//  and a pad needs to be down for four 3 ms ticks to count
+#define DEBOUNCE_BYTES 1
+#define DEBOUNCE_TICK_MS 3
+#include "Debouncer.h"
 
 void setup(){
   setupPins();
@@ -12,13 +17,6 @@ void setup(){
 int LeftPadPin = 2;
 int RightPadPin = 3;
 int LastPadHit = LEFT;
-// These hold when the pad started to be
-//  held down, for counting debounce delay.
-unsigned long LeftPadHitTimer = 0;
-unsigned long RightPadHitTimer = 0;
-
-// How long a button needs to be held down to register
-int DebounceDelay = 10;
 // LeftStickX holds steering data that persists across loops
 uint8_t LeftStickX = 128;
 // RightStickY holds accelerator data that persists across loops
@@ -43,69 +41,46 @@ void loop(){
     }
   }
   
-  // Then check the buttons to see if their state has 
-  //  changed
-  if (digitalRead(LeftPadPin) == LOW){
-    // Only record a button hit if it's been at least
-    //  a certain amount of time since it was held down
-    if ((millis() - LeftPadHitTimer) > DebounceDelay){
-      // We set LeftPadHitTimer to zero after registering
-      //  a hit, so we'll only do this bit once per press
-      if (LeftPadHitTimer > 0){
-        // Speed up
-        if (RightStickY < (255 - SpeedUpAmount))
-          RightStickY += SpeedUpAmount;
-        // And set the steering properly
-        if ((LastPadHit == LEFT) && (LeftStickX > TurnIncrement)){
-          // If we were neutral, let's start with a pretty decent turn
-          if ( LeftStickX > 125)
-            LeftStickX = 128 - FirstTurnAmount;
-          else
-            LeftStickX -= TurnIncrement;
-        }
-        if (LastPadHit == RIGHT)
-          LeftStickX = 128;
-        LastPadHit = LEFT;
-        // Finally, set the timer to zero so we
-        //  don't hit this code again until a new press
-        LeftPadHitTimer = 0;
-      }
+  // Then check the pads to see if they've just been hit.
+  //  The debouncer only says a pad was pressed once it's been
+  //  held down steadily, and only once per press.
+  uint8_t rawPads[DEBOUNCE_BYTES];
+  rawPads[0] = (!digitalRead(LeftPadPin) << LEFT) | (!digitalRead(RightPadPin) << RIGHT);
+  debounceButtons(rawPads);
+  
+  if (buttonPressed(LEFT)){
+    // Speed up
+    if (RightStickY < (255 - SpeedUpAmount))
+      RightStickY += SpeedUpAmount;
+    // And set the steering properly
+    if ((LastPadHit == LEFT) && (LeftStickX > TurnIncrement)){
+      // If we were neutral, let's start with a pretty decent turn
+      if ( LeftStickX > 125)
+        LeftStickX = 128 - FirstTurnAmount;
+      else
+        LeftStickX -= TurnIncrement;
     }
+    if (LastPadHit == RIGHT)
+      LeftStickX = 128;
+    LastPadHit = LEFT;
   }
-  // If we didn't press the pad, then reset the timer
-  if (digitalRead(LeftPadPin) == HIGH)
-    LeftPadHitTimer = millis();
   // End of Left Pad
     
-  if (digitalRead(RightPadPin) == LOW){
-    // Only record a button hit if it's been at least
-    //  a certain amount of time since it was held down
-    if ((millis() - RightPadHitTimer) > DebounceDelay){
-      // We set LeftPadHitTimer to zero after registering
-      //  a hit, so we'll only do this bit once per press
-      if (RightPadHitTimer > 0){
-        // Speed up
-        if (RightStickY < (255 - SpeedUpAmount))
-          RightStickY += SpeedUpAmount;
-        // And set the steering properly
-        if ((LastPadHit == RIGHT) && (LeftStickX < (255 - TurnIncrement))){
-          if ( LeftStickX < 125)
-            LeftStickX = 128 + FirstTurnAmount;
-          else
-            LeftStickX += TurnIncrement;
-        }
-        if (LastPadHit == LEFT)
-          LeftStickX = 128;
-        LastPadHit = RIGHT;
-        // Finally, set the timer to zero so we
-        //  don't hit this code again until a new press
-        RightPadHitTimer = 0;
-      }
+  if (buttonPressed(RIGHT)){
+    // Speed up
+    if (RightStickY < (255 - SpeedUpAmount))
+      RightStickY += SpeedUpAmount;
+    // And set the steering properly
+    if ((LastPadHit == RIGHT) && (LeftStickX < (255 - TurnIncrement))){
+      if ( LeftStickX < 125)
+        LeftStickX = 128 + FirstTurnAmount;
+      else
+        LeftStickX += TurnIncrement;
     }
+    if (LastPadHit == LEFT)
+      LeftStickX = 128;
+    LastPadHit = RIGHT;
   }
-  // If we didn't press the pad, then reset the timer
-  if (digitalRead(RightPadPin) == HIGH)
-    RightPadHitTimer = millis();
   // End of Right Pad
   
   /*if ((millis() % 500) == 0){
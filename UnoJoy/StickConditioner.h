@@ -0,0 +1,220 @@
+/*  StickConditioner.h
+ *
+ *  Turns raw 0-1023 analog readings into clean 0-255 stick values.
+ *  Each axis gets, in this order:
+ *   - calibration, so your stick's own min, center and max come out as 0, 128 and 255
+ *   - a radial deadzone, which holds both axes of a stick at center until
+ *     it's moved a little way in any direction
+ *   - an axial deadzone, which does the same for each axis on its own,
+ *     and then stretches what's left so you still get the whole range
+ *   - a response curve, so small movements can be made finer
+ *  It's all done with integer math and a few lookups - no floats and no
+ *   dividing, which are slow on an Arduino.  The dividing happens once,
+ *   when you change a setting.
+ *  There's a test that runs this on a PC in UnoJoy/StickConditionerTest.
+ *
+ *   === How to use this file ===
+ *  Add this file to your sketch, and in setup() call
+ *
+ *   loadStickCalibration();
+ *
+ *  to pick up any calibration you saved before.  Then in getControllerData(),
+ *   put your four raw readings (left X, left Y, right X, right Y) in an array and do
+ *
+ *   uint16_t rawSticks[4] = {analogRead(A0), analogRead(A1), analogRead(A2), analogRead(A3)};
+ *   uint8_t sticks[4];
+ *   conditionSticks(rawSticks, sticks);
+ *   controllerData.leftStickX = sticks[0];
+ *
+ *  The calibration is in raw readings, and the deadzones are out of 1024,
+ *   where 1024 is all the way from center to the edge:
+ *   setStickCalibration(axis, min, center, max);
+ *   setRadialDeadzone(stick, size);     // stick 0 is axes 0 and 1, stick 1 is axes 2 and 3
+ *   setAxialDeadzone(axis, size);
+ *   setStickCurve(axis, stickCurveSquared);   // or stickCurveCubed, or 0 for straight
+ *  and saveStickCalibration() keeps the calibration in EEPROM for next time.
+ *  The deadzones and curves aren't saved - set them in setup().
+ *
+ *  If you want to make your own curve, it's 17 numbers from 0 to 1024 in PROGMEM,
+ *   giving the output for inputs of 0, 64, 128, and so on up to 1024.
+ */
+
+#ifndef STICK_CONDITIONER_H
+#define STICK_CONDITIONER_H
+
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#define STICK_AXES 4
+// Deflection from center is worked out as 0 to STICK_FULL_SCALE each way
+#define STICK_FULL_SCALE 1024
+
+// Where in EEPROM the calibration is kept.  #define this before including
+//  this file if your sketch keeps something else there.
+#ifndef STICK_CALIBRATION_EEPROM_ADDRESS
+  #define STICK_CALIBRATION_EEPROM_ADDRESS 0
+#endif
+// Marks the EEPROM as holding calibration, rather than whatever was there before
+#define STICK_CALIBRATION_MAGIC 0x5C
+
+  typedef struct stickCalibration_t
+  {
+    uint16_t min;
+    uint16_t center;
+    uint16_t max;
+  } stickCalibration_t;
+
+  typedef struct stickAxis_t
+  {
+    stickCalibration_t calibration;
+    // These are all fixed point, with 8 fractional bits, and get
+    //  worked out whenever a setting changes
+    uint16_t lowScale;        // STICK_FULL_SCALE / (center - min)
+    uint16_t highScale;       // STICK_FULL_SCALE / (max - center)
+    uint16_t deadzone;
+    uint16_t deadzoneScale;   // STICK_FULL_SCALE / (STICK_FULL_SCALE - deadzone)
+    const uint16_t* curve;    // In PROGMEM, or 0 for a straight line
+  } stickAxis_t;
+
+  stickAxis_t stickAxes[STICK_AXES];
+  // The radial deadzone size for each stick, squared
+  uint32_t radialDeadzoneSquared[STICK_AXES / 2];
+
+  const uint16_t stickCurveSquared[17] PROGMEM = {
+    0, 4, 16, 36, 64, 100, 144, 196, 256, 324, 400, 484, 576, 676, 784, 900, 1024
+  };
+  const uint16_t stickCurveCubed[17] PROGMEM = {
+    0, 0, 2, 7, 16, 31, 54, 86, 128, 182, 250, 333, 432, 549, 686, 844, 1024
+  };
+
+  // Works out STICK_FULL_SCALE / span as 8.8 fixed point, rounded up so
+  //  the end of the span always reaches full scale.  Tiny spans would
+  //  overflow that, and aren't a real stick anyway.
+  static uint16_t stickScaleFor(uint16_t span){
+    if (span < 16)
+      span = 16;
+    return (((uint32_t)STICK_FULL_SCALE << 8) + span - 1) / span;
+  }
+
+  void setStickCalibration(uint8_t axis, uint16_t min, uint16_t center, uint16_t max){
+    stickAxis_t* a = &stickAxes[axis];
+    a->calibration.min = min;
+    a->calibration.center = center;
+    a->calibration.max = max;
+    a->lowScale = stickScaleFor(center > min ? center - min : 0);
+    a->highScale = stickScaleFor(max > center ? max - center : 0);
+  }
+
+  void setAxialDeadzone(uint8_t axis, uint16_t size){
+    if (size > STICK_FULL_SCALE - 16)
+      size = STICK_FULL_SCALE - 16;
+    stickAxes[axis].deadzone = size;
+    stickAxes[axis].deadzoneScale = stickScaleFor(STICK_FULL_SCALE - size);
+  }
+
+  void setRadialDeadzone(uint8_t stick, uint16_t size){
+    radialDeadzoneSquared[stick] = (uint32_t)size * size;
+  }
+
+  void setStickCurve(uint8_t axis, const uint16_t* curve){
+    stickAxes[axis].curve = curve;
+  }
+
+  // Puts every axis back to the full 0-1023 range, centered at 512,
+  //  with no deadzones and no curve
+  void resetStickConditioning(void){
+    for (uint8_t i = 0; i < STICK_AXES; i++){
+      setStickCalibration(i, 0, 512, 1023);
+      setAxialDeadzone(i, 0);
+      setStickCurve(i, 0);
+    }
+    for (uint8_t i = 0; i < STICK_AXES / 2; i++)
+      setRadialDeadzone(i, 0);
+  }
+
+  // Loads the calibration saved by saveStickCalibration().  If nothing's
+  //  been saved yet, everything gets reset instead, and this returns 0.
+  uint8_t loadStickCalibration(void){
+    stickCalibration_t saved[STICK_AXES];
+    resetStickConditioning();
+    if (eeprom_read_byte((uint8_t*)STICK_CALIBRATION_EEPROM_ADDRESS) != STICK_CALIBRATION_MAGIC)
+      return 0;
+    eeprom_read_block(saved, (void*)(STICK_CALIBRATION_EEPROM_ADDRESS + 1), sizeof(saved));
+    for (uint8_t i = 0; i < STICK_AXES; i++)
+      setStickCalibration(i, saved[i].min, saved[i].center, saved[i].max);
+    return 1;
+  }
+
+  void saveStickCalibration(void){
+    stickCalibration_t saved[STICK_AXES];
+    for (uint8_t i = 0; i < STICK_AXES; i++)
+      saved[i] = stickAxes[i].calibration;
+    eeprom_update_block(saved, (void*)(STICK_CALIBRATION_EEPROM_ADDRESS + 1), sizeof(saved));
+    eeprom_update_byte((uint8_t*)STICK_CALIBRATION_EEPROM_ADDRESS, STICK_CALIBRATION_MAGIC);
+  }
+
+  // Calibrates a raw reading into a deflection from center,
+  //  from -STICK_FULL_SCALE to STICK_FULL_SCALE
+  static inline int16_t calibrateStickAxis(const stickAxis_t* a, uint16_t raw){
+    uint32_t deflection;
+    if (raw >= a->calibration.center){
+      deflection = ((uint32_t)(raw - a->calibration.center) * a->highScale) >> 8;
+      if (deflection > STICK_FULL_SCALE)
+        deflection = STICK_FULL_SCALE;
+      return deflection;
+    }
+    deflection = ((uint32_t)(a->calibration.center - raw) * a->lowScale) >> 8;
+    if (deflection > STICK_FULL_SCALE)
+      deflection = STICK_FULL_SCALE;
+    return -(int16_t)deflection;
+  }
+
+  // Applies the axial deadzone and the curve to a deflection,
+  //  and turns it into a 0-255 stick value
+  static inline uint8_t shapeStickAxis(const stickAxis_t* a, int16_t deflection){
+    uint16_t size = deflection < 0 ? -deflection : deflection;
+    if (size <= a->deadzone)
+      return 128;
+    size = ((uint32_t)(size - a->deadzone) * a->deadzoneScale) >> 8;
+    if (size > STICK_FULL_SCALE)
+      size = STICK_FULL_SCALE;
+    if (a->curve){
+      // 17 points, 64 apart, with a straight line between each pair
+      uint8_t point = size >> 6;
+      uint16_t low = pgm_read_word(&a->curve[point]);
+      if (point < 16){
+        uint16_t high = pgm_read_word(&a->curve[point + 1]);
+        size = low + (((uint16_t)(high - low) * (size & 63)) >> 6);
+      }
+      else
+        size = low;
+    }
+    if (deflection < 0)
+      return 128 - (((uint32_t)size * 128 + 512) >> 10);
+    return 128 + (((uint32_t)size * 127 + 512) >> 10);
+  }
+
+  // Conditions a single axis, without the radial deadzone
+  uint8_t conditionStickAxis(uint8_t axis, uint16_t raw){
+    const stickAxis_t* a = &stickAxes[axis];
+    return shapeStickAxis(a, calibrateStickAxis(a, raw));
+  }
+
+  // Conditions all four axes, from raw 0-1023 readings to 0-255 stick values
+  void conditionSticks(const uint16_t* raw, uint8_t* sticks){
+    for (uint8_t stick = 0; stick < STICK_AXES / 2; stick++){
+      const stickAxis_t* x = &stickAxes[stick * 2];
+      const stickAxis_t* y = &stickAxes[stick * 2 + 1];
+      int16_t dx = calibrateStickAxis(x, raw[stick * 2]);
+      int16_t dy = calibrateStickAxis(y, raw[stick * 2 + 1]);
+      if ((uint32_t)((int32_t)dx * dx) + (uint32_t)((int32_t)dy * dy) < radialDeadzoneSquared[stick]){
+        dx = 0;
+        dy = 0;
+      }
+      sticks[stick * 2] = shapeStickAxis(x, dx);
+      sticks[stick * 2 + 1] = shapeStickAxis(y, dy);
+    }
+  }
+
+#endif
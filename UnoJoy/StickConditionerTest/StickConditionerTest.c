@@ -0,0 +1,241 @@
+/*  StickConditionerTest.c
+ *
+ *  This checks StickConditioner.h on a PC, so you can change it without
+ *   wiring up a stick and watching the visualizer every time.
+ *  It builds the library for the PC (the hostAVR folder has stand-ins for
+ *   the AVR headers, with the EEPROM as an ordinary array), then runs the
+ *   raw readings from 0 to 1023 through it with different settings -
+ *   calibration, the axial and radial deadzones, and the curves - and checks
+ *   saving and loading the calibration through the EEPROM.
+ *
+ *  To build it:
+ *      gcc -Wall -Wextra -I hostAVR -o StickConditionerTest StickConditionerTest.c
+ *
+ *  To use it:
+ *      ./StickConditionerTest        (prints each check, and any problems)
+ *  It exits with 0 if everything was right, or 1 if anything wasn't.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The library itself, built for the PC
+#include "../StickConditioner.h"
+
+int problems = 0;
+
+// Checks that the stick value we got is the one we expected
+void expectValue(const char* what, uint16_t raw, uint8_t got, uint8_t expected){
+	if (got != expected){
+		printf("    %s: raw %u gave %u, expected %u\n", what, raw, got, expected);
+		problems++;
+	}
+}
+
+// Checks that the stick value is within slack of the one we expected
+void expectNear(const char* what, uint16_t raw, uint8_t got, uint8_t expected, uint8_t slack){
+	if (abs((int)got - (int)expected) > slack){
+		printf("    %s: raw %u gave %u, expected %u give or take %u\n", what, raw, got, expected, slack);
+		problems++;
+	}
+}
+
+// Runs every raw reading through one axis, and checks that the stick
+//  value never goes backwards as the stick moves from min to max
+void expectMonotonic(const char* what, uint8_t axis){
+	uint8_t last = conditionStickAxis(axis, 0);
+	for (uint16_t raw = 1; raw < 1024; raw++){
+		uint8_t value = conditionStickAxis(axis, raw);
+		if (value < last){
+			printf("    %s: raw %u gave %u, after %u for raw %u\n", what, raw, value, last, raw - 1);
+			problems++;
+			return;
+		}
+		last = value;
+	}
+}
+
+void testDefaults(void){
+	printf("defaults\n");
+	resetStickConditioning();
+	for (uint8_t axis = 0; axis < STICK_AXES; axis++){
+		expectValue("bottom", 0, conditionStickAxis(axis, 0), 0);
+		expectValue("center", 512, conditionStickAxis(axis, 512), 128);
+		expectValue("top", 1023, conditionStickAxis(axis, 1023), 255);
+		expectMonotonic("straight line", axis);
+	}
+	// Straight through, every reading should land within a step
+	//  of the plain 10 bit to 8 bit conversion
+	for (uint16_t raw = 0; raw < 1024; raw++)
+		expectNear("straight line", raw, conditionStickAxis(0, raw), raw >> 2, 1);
+}
+
+void testCalibration(void){
+	printf("calibration\n");
+	resetStickConditioning();
+	// A stick that only moves from 100 to 900, and rests off center at 400
+	setStickCalibration(0, 100, 400, 900);
+	expectValue("min", 100, conditionStickAxis(0, 100), 0);
+	expectValue("center", 400, conditionStickAxis(0, 400), 128);
+	expectValue("max", 900, conditionStickAxis(0, 900), 255);
+	expectValue("below min", 20, conditionStickAxis(0, 20), 0);
+	expectValue("above max", 1000, conditionStickAxis(0, 1000), 255);
+	// Halfway each side should be halfway to each end
+	expectNear("halfway down", 250, conditionStickAxis(0, 250), 64, 1);
+	expectNear("halfway up", 650, conditionStickAxis(0, 650), 192, 1);
+	expectMonotonic("calibrated", 0);
+	// The other axes shouldn't have been touched
+	expectValue("other axis", 512, conditionStickAxis(1, 512), 128);
+	// A calibration with no room on one side mustn't blow up
+	setStickCalibration(1, 512, 512, 1023);
+	expectValue("empty side", 0, conditionStickAxis(1, 0), 0);
+	expectValue("empty side center", 512, conditionStickAxis(1, 512), 128);
+	expectMonotonic("empty side", 1);
+}
+
+void testAxialDeadzone(void){
+	printf("axial deadzone\n");
+	resetStickConditioning();
+	// A tenth of the way from center to the edge, about 51 raw each way
+	setAxialDeadzone(0, 102);
+	for (uint16_t raw = 462; raw <= 562; raw++)
+		expectValue("inside", raw, conditionStickAxis(0, raw), 128);
+	// The rest gets stretched, so the ends still reach all the way
+	expectValue("bottom", 0, conditionStickAxis(0, 0), 0);
+	expectValue("top", 1023, conditionStickAxis(0, 1023), 255);
+	// And it starts moving again just outside, without a jump
+	expectNear("just outside, up", 570, conditionStickAxis(0, 570), 129, 2);
+	expectNear("just outside, down", 454, conditionStickAxis(0, 454), 127, 2);
+	expectMonotonic("axial deadzone", 0);
+	// The biggest deadzone still leaves the ends working
+	setAxialDeadzone(1, STICK_FULL_SCALE);
+	expectValue("huge, center", 800, conditionStickAxis(1, 800), 128);
+	expectValue("huge, top", 1023, conditionStickAxis(1, 1023), 255);
+}
+
+void testRadialDeadzone(void){
+	printf("radial deadzone\n");
+	resetStickConditioning();
+	setRadialDeadzone(0, 200);
+	uint16_t raw[4];
+	uint8_t sticks[4];
+	// About 141 out of 1024 from center, on the diagonal - inside
+	raw[0] = 562; raw[1] = 562; raw[2] = 562; raw[3] = 562;
+	conditionSticks(raw, sticks);
+	expectValue("diagonal inside, X", raw[0], sticks[0], 128);
+	expectValue("diagonal inside, Y", raw[1], sticks[1], 128);
+	// Stick 1 has no deadzone, so it moves
+	expectNear("other stick", raw[2], sticks[2], 140, 1);
+	// About 212 out of 1024 on the diagonal - outside, so both
+	//  axes move, even though each on its own is inside
+	raw[0] = 587; raw[1] = 587;
+	conditionSticks(raw, sticks);
+	expectNear("diagonal outside, X", raw[0], sticks[0], 146, 1);
+	expectNear("diagonal outside, Y", raw[1], sticks[1], 146, 1);
+	// Straight along one axis, inside and then outside
+	raw[0] = 600; raw[1] = 512;
+	conditionSticks(raw, sticks);
+	expectValue("along X inside, X", raw[0], sticks[0], 128);
+	raw[0] = 650;
+	conditionSticks(raw, sticks);
+	expectNear("along X outside, X", raw[0], sticks[0], 162, 1);
+	expectValue("along X outside, Y", raw[1], sticks[1], 128);
+}
+
+void testCurves(void){
+	printf("curves\n");
+	resetStickConditioning();
+	setStickCurve(0, stickCurveSquared);
+	setStickCurve(1, stickCurveCubed);
+	// Half way out is a quarter of the way with squared, an eighth cubed
+	expectNear("squared, half up", 768, conditionStickAxis(0, 768), 160, 1);
+	expectNear("squared, half down", 256, conditionStickAxis(0, 256), 96, 1);
+	expectNear("cubed, half up", 768, conditionStickAxis(1, 768), 144, 1);
+	// The ends and the center don't move
+	for (uint8_t axis = 0; axis < 2; axis++){
+		expectValue("curved bottom", 0, conditionStickAxis(axis, 0), 0);
+		expectValue("curved center", 512, conditionStickAxis(axis, 512), 128);
+		expectValue("curved top", 1023, conditionStickAxis(axis, 1023), 255);
+		expectMonotonic("curved", axis);
+	}
+	// A curve goes on top of the deadzone, from its edge
+	setAxialDeadzone(0, 512);
+	expectValue("curve and deadzone, inside", 700, conditionStickAxis(0, 700), 128);
+	expectNear("curve and deadzone, half up", 895, conditionStickAxis(0, 895), 160, 1);
+	expectMonotonic("curve and deadzone", 0);
+}
+
+void testEEPROM(void){
+	printf("EEPROM\n");
+	hostEraseEEPROM();
+	// Nothing saved yet, so we get the defaults
+	setStickCalibration(0, 100, 400, 900);
+	if (loadStickCalibration() != 0){
+		printf("    loaded calibration from a blank EEPROM\n");
+		problems++;
+	}
+	expectValue("blank EEPROM", 512, conditionStickAxis(0, 512), 128);
+
+	// Save one calibration per axis, then mess them up
+	for (uint8_t axis = 0; axis < STICK_AXES; axis++)
+		setStickCalibration(axis, 10 * axis, 400 + 10 * axis, 900 + 10 * axis);
+	setAxialDeadzone(0, 200);
+	saveStickCalibration();
+	if (hostEEPROM[STICK_CALIBRATION_EEPROM_ADDRESS] != STICK_CALIBRATION_MAGIC){
+		printf("    no magic byte at STICK_CALIBRATION_EEPROM_ADDRESS\n");
+		problems++;
+	}
+	resetStickConditioning();
+
+	// Loading puts them back, and resets everything that isn't saved
+	if (loadStickCalibration() != 1){
+		printf("    didn't load the saved calibration\n");
+		problems++;
+	}
+	for (uint8_t axis = 0; axis < STICK_AXES; axis++){
+		stickCalibration_t c = stickAxes[axis].calibration;
+		if (c.min != 10 * axis || c.center != 400 + 10 * axis || c.max != 900 + 10 * axis){
+			printf("    axis %u came back as %u, %u, %u\n", axis, c.min, c.center, c.max);
+			problems++;
+		}
+		expectValue("loaded center", 400 + 10 * axis, conditionStickAxis(axis, 400 + 10 * axis), 128);
+	}
+	if (stickAxes[0].deadzone != 0){
+		printf("    the deadzone came back from EEPROM\n");
+		problems++;
+	}
+
+	// Saving the same thing again shouldn't change anything
+	uint8_t before[HOST_EEPROM_SIZE];
+	memcpy(before, hostEEPROM, sizeof(before));
+	saveStickCalibration();
+	if (memcmp(before, hostEEPROM, sizeof(before)) != 0){
+		printf("    saving the same calibration changed the EEPROM\n");
+		problems++;
+	}
+}
+
+int main(void){
+	testDefaults();
+	testCalibration();
+	testAxialDeadzone();
+	testRadialDeadzone();
+	testCurves();
+	testEEPROM();
+	printf("\n%d problems\n", problems);
+	return problems ? 1 : 0;
+}
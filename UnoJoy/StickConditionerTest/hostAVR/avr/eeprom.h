@@ -0,0 +1,38 @@
+/*  hostAVR/avr/eeprom.h
+ *
+ *  The EEPROM is just an array on the PC, starting out erased (all 0xFF)
+ *   like a new chip.  The test can look at it and wipe it between runs.
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+static uint8_t hostEEPROM[HOST_EEPROM_SIZE];
+
+static void hostEraseEEPROM(void){
+	memset(hostEEPROM, 0xFF, sizeof(hostEEPROM));
+}
+
+static uint8_t eeprom_read_byte(const uint8_t* address){
+	return hostEEPROM[(size_t)address];
+}
+
+static void eeprom_update_byte(uint8_t* address, uint8_t value){
+	hostEEPROM[(size_t)address] = value;
+}
+
+static void eeprom_read_block(void* destination, const void* source, size_t size){
+	memcpy(destination, &hostEEPROM[(size_t)source], size);
+}
+
+static void eeprom_update_block(const void* source, void* destination, size_t size){
+	memcpy(&hostEEPROM[(size_t)destination], source, size);
+}
+
+#endif
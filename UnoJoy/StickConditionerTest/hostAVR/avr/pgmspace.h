@@ -0,0 +1,16 @@
+/*  hostAVR/avr/pgmspace.h
+ *
+ *  There's only one kind of memory on the PC, so PROGMEM tables
+ *   are just ordinary constant arrays.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(address))
+
+#endif
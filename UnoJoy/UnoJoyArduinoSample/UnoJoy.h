@@ -12,6 +12,12 @@
  *   NOTE: You cannot use pins 0 or 1 if you use this code - they are used by the serial communication.
  *         Also, the setupUnoJoy() function starts the serial port at 38400, so if you're using
  *         the serial port to debug and it's not working, this may be your problem.
+ *         Once the UnoJoy firmware is running, it will also ask to speed the link up to as much
+ *         as 1,000,000 baud.  If you need to cap that, #define UNOJOY_MAX_BAUD before including this file.
+ *         If you #define UNOJOY_USART_RESPONDER before including this file, UnoJoy runs the serial
+ *         port itself and answers the firmware straight from the serial receive interrupt, instead
+ *         of checking for requests from a 1 ms timer interrupt.  Timer 0 is left alone, but you
+ *         can't use Serial at all.
  *   
  *   === How to use this library ===
  *   If you want, you can move this file into your Arduino/Libraries folder, then use it like a normal library.
@@ -47,7 +53,9 @@
 #ifndef UNOJOY_H
 #define UNOJOY_H
     #include <stdint.h>
+    #include <string.h>
     #include <util/atomic.h>
+    #include <util/crc16.h>
     #include <Arduino.h>
 
     // This struct is the core of the library.
@@ -108,29 +116,51 @@
     //    myControllerData = getBlankDataForController();
     dataForController_t getBlankDataForController(void);
     
+    // Instead of building a whole dataForController_t every loop, you can
+    //  also change the controller data a piece at a time, then call commit()
+    //  to send all your changes out together:
+    //    setButton(UNOJOY_CROSS, digitalRead(2) == LOW);
+    //    setAxis(UNOJOY_LEFT_STICK_X, analogRead(A0) >> 2);
+    //    commit();
+    //  setButtons takes a mask with one bit per button, (1UL << UNOJOY_CROSS)
+    //  for cross and so on, and sets every button at once.  Anything you don't
+    //  change keeps whatever it was last time.
+    enum {
+      UNOJOY_TRIANGLE, UNOJOY_CIRCLE, UNOJOY_SQUARE, UNOJOY_CROSS,
+      UNOJOY_L1, UNOJOY_L2, UNOJOY_L3, UNOJOY_R1,
+      UNOJOY_R2, UNOJOY_R3, UNOJOY_SELECT, UNOJOY_START,
+      UNOJOY_HOME, UNOJOY_DPAD_LEFT, UNOJOY_DPAD_UP, UNOJOY_DPAD_RIGHT,
+      UNOJOY_DPAD_DOWN
+    };
+    enum {
+      UNOJOY_LEFT_STICK_X, UNOJOY_LEFT_STICK_Y,
+      UNOJOY_RIGHT_STICK_X, UNOJOY_RIGHT_STICK_Y
+    };
+    void setButtons(uint32_t);
+    void setButton(uint8_t, uint8_t);
+    void setAxis(uint8_t, uint8_t);
+    void commit(void);
+    
     
 //----- End of the interface code you should be using -----//
 //----- Below here is the actual implementation of
     
-  // This dataForController_t is used to store
-  //  the controller data that you want to send
-  //  out to the controller.  You shouldn't mess
-  //  with this directly - call setControllerData instead
-  dataForController_t controllerDataBuffer;
+  // The controller data that you want to send out lives in one of
+  //  these buffers.  setControllerData fills in one the interrupts
+  //  aren't using, then publishes it by changing publishedBuffer.
+  //  That's a single byte, so the interrupts always see a whole update,
+  //  and we never have to turn them off.  There are three so that the
+  //  firmware can still be reading an older one a byte at a time
+  //  (servingBuffer) while we fill in the next.
+  //  You shouldn't mess with these directly - call setControllerData instead
+  #define UNOJOY_BUFFER_COUNT 3
+  dataForController_t controllerDataBuffers[UNOJOY_BUFFER_COUNT];
+  volatile uint8_t publishedBuffer = 0;
+  volatile uint8_t servingBuffer = 0;
+  // setButtons, setButton and setAxis change this copy, and commit
+  //  publishes it.  It's only ever touched outside of interrupts.
+  dataForController_t controllerDataDraft;
 
-  // This updates the data that the controller is sending out.
-  //  The system actually works as following:
-  //  The UnoJoy firmware on the ATmega8u2 regularly polls the
-  //  Arduino chip for individual bytes of a dataForController_t.
-  //  
-  void setControllerData(dataForController_t controllerData){
-    // Probably unecessary, but this guarantees that the data
-    //  gets copied to our buffer all at once.
-    ATOMIC_BLOCK(ATOMIC_FORCEON){
-      controllerDataBuffer = controllerData;
-    }
-  }
-  
   // serialCheckInterval governs how many ms between
   //  checks to the serial port for data.
   //  It shouldn't go above 20 or so, otherwise you might
@@ -143,18 +173,156 @@
   //  serial check times
   int serialCheckCounter = 0;
   
+  // The link always starts out at 38400, so the Processing visualizer
+  //  can talk to us.  The UnoJoy firmware then offers faster rates by
+  //  sending one of these codes.  If we can do that rate, we echo the
+  //  code back and switch over.  If the firmware stops asking us for
+  //  data for UNOJOY_LINK_TIMEOUT ms, we assume it lost track of us
+  //  (say, because it got reset) and drop back to 38400.
+  #define UNOJOY_DEFAULT_BAUD 38400
+  #define UNOJOY_BAUD_250K 0xE1
+  #define UNOJOY_BAUD_500K 0xE2
+  #define UNOJOY_BAUD_1M 0xE3
+  #define UNOJOY_LINK_TIMEOUT 100
+  #ifndef UNOJOY_MAX_BAUD
+    #define UNOJOY_MAX_BAUD 1000000
+  #endif
+  
+  // The rate we're running the link at now
+  volatile long unoJoyBaudRate = UNOJOY_DEFAULT_BAUD;
+  // A rate we've agreed to switch to, but haven't yet, because
+  //  our answer has to go out at the old rate first
+  volatile long pendingBaudRate = 0;
+  // When the firmware last sent us a snapshot or stream request, in ms
+  volatile unsigned long lastRequestMillis = 0;
+  
+  // Returns the baud rate for one of the UNOJOY_BAUD_ codes,
+  //  or 0 if it's not a code, or a rate we can't do
+  long baudRateForCode(byte code){
+    long baudRate = 0;
+    if (code == UNOJOY_BAUD_250K)
+      baudRate = 250000;
+    else if (code == UNOJOY_BAUD_500K)
+      baudRate = 500000;
+    else if (code == UNOJOY_BAUD_1M)
+      baudRate = 1000000;
+    if (baudRate > UNOJOY_MAX_BAUD)
+      baudRate = 0;
+    return baudRate;
+  }
+  
+#ifdef UNOJOY_USART_RESPONDER
+  // With UNOJOY_USART_RESPONDER, we run the USART ourselves instead of
+  //  going through Serial, and answer each request from the firmware
+  //  right in the receive interrupt.  The ATmega328p calls its USART
+  //  interrupts USART_*, and the chips with more than one call them USART0_*
+  #if defined(USART_RX_vect)
+    #define UNOJOY_RX_vect USART_RX_vect
+    #define UNOJOY_UDRE_vect USART_UDRE_vect
+  #else
+    #define UNOJOY_RX_vect USART0_RX_vect
+    #define UNOJOY_UDRE_vect USART0_UDRE_vect
+  #endif
+  
+  // What we send goes into this ring buffer, and the data register
+  //  empty interrupt feeds it out.  The size has to be a power of two.
+  #define UNOJOY_TX_BUFFER_SIZE 32
+  #define UNOJOY_TX_BUFFER_MASK (UNOJOY_TX_BUFFER_SIZE - 1)
+  volatile uint8_t unoJoyTxBuffer[UNOJOY_TX_BUFFER_SIZE];
+  volatile uint8_t unoJoyTxHead = 0;
+  volatile uint8_t unoJoyTxTail = 0;
+  
+  // Moves the next byte from the ring buffer to the USART.
+  //  Only call this with interrupts off and UDRE0 set.
+  void unoJoySendNextByte(void){
+    UDR0 = unoJoyTxBuffer[unoJoyTxTail];
+    unoJoyTxTail = (unoJoyTxTail + 1) & UNOJOY_TX_BUFFER_MASK;
+  }
+  
+  // Sends a byte to the UnoJoy firmware
+  void unoJoyWrite(uint8_t data){
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      // If nothing's waiting and the USART's free, it goes straight out
+      if (unoJoyTxHead == unoJoyTxTail && (UCSR0A & (1 << UDRE0))){
+        UDR0 = data;
+        return;
+      }
+      uint8_t nextHead = (unoJoyTxHead + 1) & UNOJOY_TX_BUFFER_MASK;
+      // If the buffer's full, we may well be inside an interrupt,
+      //  so we feed bytes out by hand until there's room
+      while (nextHead == unoJoyTxTail){
+        if (UCSR0A & (1 << UDRE0))
+          unoJoySendNextByte();
+      }
+      unoJoyTxBuffer[unoJoyTxHead] = data;
+      unoJoyTxHead = nextHead;
+      UCSR0B |= (1 << UDRIE0);
+    }
+  }
+  
+  // Sends out everything in the ring buffer by hand.  Only call
+  //  this with interrupts off.
+  void unoJoyDrainWrite(void){
+    while (unoJoyTxHead != unoJoyTxTail){
+      if (UCSR0A & (1 << UDRE0))
+        unoJoySendNextByte();
+    }
+    UCSR0B &= ~(1 << UDRIE0);
+    while (!(UCSR0A & (1 << UDRE0)))
+      ;
+  }
+  
+  // Starts the USART at the given rate, with the same settings
+  //  Serial.begin would use, plus our receive interrupt
+  void unoJoyBeginSerial(long baudRate){
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      unoJoyTxHead = unoJoyTxTail = 0;
+      UCSR0B = 0;
+      UCSR0A = (1 << U2X0);
+      UBRR0 = (F_CPU / 4 / baudRate - 1) / 2;
+      UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+      UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+    }
+  }
+#else
+  // Sends a byte to the UnoJoy firmware
+  void unoJoyWrite(uint8_t data){
+    Serial.write(data);
+  }
+  
+  // Starts the serial port at the given rate,
+  //  and throws away anything we received at the old one
+  void unoJoyBeginSerial(long baudRate){
+    Serial.begin(baudRate);
+    while (Serial.available() > 0)
+      Serial.read();
+  }
+#endif
+  
+  // This restarts the serial port at a new rate
+  void setUnoJoyBaudRate(long baudRate){
+    unoJoyBeginSerial(baudRate);
+    unoJoyBaudRate = baudRate;
+    lastRequestMillis = millis();
+  }
+  
   // This is the setup function - it sets up the serial communication
   //  and the timer interrupt for actually sending the data back and forth.
   void setupUnoJoy(void){
     // First, let's zero out our controller data buffer (center the sticks)
-    controllerDataBuffer = getBlankDataForController();
+    controllerDataBuffers[0] = getBlankDataForController();
+    controllerDataDraft = controllerDataBuffers[0];
+    publishedBuffer = 0;
+    servingBuffer = 0;
   
     // Start the serial port at the specific, low-error rate UnoJoy uses.
     //  If you want to change the rate, you'll have to change it in the
     //  firmware for the ATmega8u2 as well.  250,000 is actually the best rate,
-    //  but it's not supported on Macs, breaking the processing debugger.
-    Serial.begin(38400);
+    //  but it's not supported on Macs, breaking the processing debugger,
+    //  so we start at 38400 and let the UnoJoy firmware ask for more.
+    unoJoyBeginSerial(UNOJOY_DEFAULT_BAUD);
     
+#ifndef UNOJOY_USART_RESPONDER
     // Now set up the Timer 0 compare register A
     //  so that Timer0 (used for millis() and such)
     //  also fires an interrupt when it's equal to
@@ -163,22 +331,277 @@
     //  every 1 ms (1024 us to be exact).
     OCR0A = 128;
     TIMSK0 |= (1 << OCIE0A);
+#endif
   }
   
   // If you really need to change the serial polling
   //  interval, use this function to initialize UnoJoy.
   //  interval is the polling frequency, in ms.
+  //  With UNOJOY_USART_RESPONDER there's no polling, so it's ignored.
   void setupUnoJoy(int interval){
     serialCheckInterval = interval;
     setupUnoJoy();
   }
   
+  // These are the codes used on the serial line between the Arduino
+  //  and the UnoJoy firmware.  A request byte smaller than
+  //  sizeof(dataForController_t) asks for just that byte of the
+  //  controller data.  UNOJOY_SNAPSHOT_REQUEST asks for all of it at once,
+  //  which we send back as a frame:
+  //    UNOJOY_FRAME_START, sizeof(dataForController_t), a sequence number,
+  //    the data itself, then a CRC-8 of everything after UNOJOY_FRAME_START
+  //  The sequence number goes up by one every frame, so the firmware can
+  //  tell if it missed one, and the CRC lets it throw away frames that
+  //  got garbled on the way.
+  //  UNOJOY_STREAM_REQUEST asks us to push a frame out on our own
+  //  every time the data changes, so the firmware doesn't have to
+  //  keep polling.  We answer it with a frame straight away, and the
+  //  firmware keeps sending it every so often so we know it's still
+  //  listening - if it stops, we go back to just answering polls.
+  //  If you #define UNOJOY_POLL_ONLY before including this file,
+  //  we never push, and the firmware sticks to polling.
+  #define UNOJOY_SNAPSHOT_REQUEST 0xF0
+  #define UNOJOY_STREAM_REQUEST 0xF3
+  #define UNOJOY_FRAME_START 0xA5
+  
+  // Whether the firmware has asked us to push frames
+  volatile uint8_t unoJoyStreaming = 0;
+  // Set when there's changed data that we haven't pushed out yet
+  volatile uint8_t framePending = 0;
+  // When we sent our last frame, in us
+  unsigned long lastFrameMicros = 0;
+  // The sequence number for the next frame we send
+  uint8_t frameSequence = 0;
+  // The start byte, length, sequence number and CRC around the data
+  #define UNOJOY_FRAME_OVERHEAD 4
+  
+  // This sends out the published controller data as one frame
+  void sendControllerDataFrame(void){
+    uint8_t* data = (uint8_t*)&controllerDataBuffers[publishedBuffer];
+    uint8_t crc = _crc_ibutton_update(0, sizeof(dataForController_t));
+    crc = _crc_ibutton_update(crc, frameSequence);
+    for (uint8_t i = 0; i < sizeof(dataForController_t); i++)
+      crc = _crc_ibutton_update(crc, data[i]);
+    unoJoyWrite(UNOJOY_FRAME_START);
+    unoJoyWrite((uint8_t)sizeof(dataForController_t));
+    unoJoyWrite(frameSequence);
+    for (uint8_t i = 0; i < sizeof(dataForController_t); i++)
+      unoJoyWrite(data[i]);
+    unoJoyWrite(crc);
+    frameSequence++;
+    lastFrameMicros = micros();
+    framePending = 0;
+  }
+  
+#ifndef UNOJOY_USART_RESPONDER
+  // This pushes out a frame right away if the last one has had time to
+  //  get down the wire, so we never pile frames up in the serial buffer.
+  //  Otherwise it leaves it for the timer interrupt to send a bit later.
+  //  (With UNOJOY_USART_RESPONDER, the data register empty interrupt
+  //  does this job, since it only runs once the last frame's gone.)
+  void pushControllerDataFrame(void){
+    // 10 bits per byte on the wire
+    unsigned long frameMicros = (10UL * 1000000UL * (UNOJOY_FRAME_OVERHEAD + sizeof(dataForController_t))) / unoJoyBaudRate;
+    if (micros() - lastFrameMicros >= frameMicros)
+      sendControllerDataFrame();
+    else
+      framePending = 1;
+  }
+#endif
+  
+  // If we've sped the link up, or we're pushing frames, and the
+  //  firmware hasn't asked us for anything in a while, we go back
+  //  to 38400 and just answer polls.  Returns 1 if we did.
+  uint8_t checkUnoJoyLinkTimeout(void){
+    if (unoJoyBaudRate == UNOJOY_DEFAULT_BAUD && !unoJoyStreaming)
+      return 0;
+    if (millis() - lastRequestMillis <= UNOJOY_LINK_TIMEOUT)
+      return 0;
+    unoJoyStreaming = 0;
+    if (unoJoyBaudRate != UNOJOY_DEFAULT_BAUD)
+      setUnoJoyBaudRate(UNOJOY_DEFAULT_BAUD);
+    return 1;
+  }
+  
+  // Frames only ever get sent from our interrupts, or with interrupts
+  //  turned off, so they can't get mixed up on the wire.  This sends a
+  //  pushed frame as soon as it can, rather than whenever our interrupt
+  //  would next come around.
+  void wakeUnoJoySender(void){
+#ifdef UNOJOY_USART_RESPONDER
+    // The data register empty interrupt fires as soon as it's enabled.
+    //  If an interrupt changes UCSR0B while we do this, the worst that
+    //  happens is one spare interrupt that finds nothing to do.
+    UCSR0B |= (1 << UDRIE0);
+#else
+    // Timer 0 runs in fast PWM mode for millis(), where a new OCR0A only
+    //  takes effect at the bottom of the count, so we can't make the
+    //  timer interrupt come around any sooner.  Instead we push the frame
+    //  from right here, with interrupts off so the timer interrupt can't
+    //  answer a request halfway through it.  A frame fits in the serial
+    //  transmit buffer, so that's only as long as it takes to copy it in.
+    //  If the last frame is still going out, the timer interrupt sends
+    //  this one once it's gone.
+    uint8_t oldSREG = SREG;
+    cli();
+    pushControllerDataFrame();
+    SREG = oldSREG;
+#endif
+  }
+  
+  // This updates the data that the controller is sending out.
+  //  The system actually works as following:
+  //  The UnoJoy firmware on the ATmega8u2 regularly polls the
+  //  Arduino chip for a snapshot of the dataForController_t,
+  //  or, if it asked us to push, we send it a frame every time
+  //  the data changes.
+  void setControllerData(dataForController_t controllerData){
+    controllerDataDraft = controllerData;
+    commit();
+  }
+  
+  // This publishes the changes made with setButtons, setButton and
+  //  setAxis, the same way setControllerData does.
+  void commit(void){
+    // Fill in a buffer that isn't published, and that the firmware
+    //  isn't reading.  servingBuffer can only change to publishedBuffer
+    //  behind our back, so this one stays free until we publish it.
+    uint8_t published = publishedBuffer;
+    uint8_t serving = servingBuffer;
+    uint8_t next = 0;
+    while (next == published || next == serving)
+      next++;
+    controllerDataBuffers[next] = controllerDataDraft;
+    uint8_t changed = memcmp(&controllerDataBuffers[published], &controllerDataDraft, sizeof(dataForController_t));
+    publishedBuffer = next;
+    if (unoJoyStreaming && changed){
+      framePending = 1;
+      wakeUnoJoySender();
+    }
+  }
+  
+  // The buttons are the first 17 bits of a dataForController_t, in the
+  //  same order as the UNOJOY_ button numbers, and the sticks are the
+  //  4 bytes after that, so these can go straight to the bits and bytes
+  //  they change.
+  #define UNOJOY_BUTTON_COUNT 17
+  #define UNOJOY_AXIS_START 3
+  
+  void setButtons(uint32_t buttons){
+    uint8_t* data = (uint8_t*)&controllerDataDraft;
+    data[0] = (uint8_t)buttons;
+    data[1] = (uint8_t)(buttons >> 8);
+    data[2] = (uint8_t)(buttons >> 16) & 1;
+  }
+  
+  void setButton(uint8_t button, uint8_t on){
+    if (button >= UNOJOY_BUTTON_COUNT)
+      return;
+    uint8_t* data = (uint8_t*)&controllerDataDraft + (button >> 3);
+    uint8_t mask = 1 << (button & 7);
+    if (on)
+      *data |= mask;
+    else
+      *data &= ~mask;
+  }
+  
+  void setAxis(uint8_t axis, uint8_t value){
+    if (axis > UNOJOY_RIGHT_STICK_Y)
+      return;
+    ((uint8_t*)&controllerDataDraft)[UNOJOY_AXIS_START + axis] = value;
+  }
+  
+  // Agrees to one of the UNOJOY_BAUD_ codes by echoing it back.
+  //  The echo has to go out at the old rate before we switch.
+  void acceptUnoJoyBaudRate(byte code){
+#ifdef UNOJOY_USART_RESPONDER
+    // We're in the receive interrupt, so we send it by hand and
+    //  switch as soon as it's gone.  That's a few hundred us at most,
+    //  and only happens while the link is starting up.
+    unoJoyDrainWrite();
+    UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
+    UDR0 = code;
+    while (!(UCSR0A & (1 << TXC0)))
+      ;
+    setUnoJoyBaudRate(baudRateForCode(code));
+#else
+    // The timer interrupt switches over next time around,
+    //  once this has gone out
+    Serial.write(code);
+    pendingBaudRate = baudRateForCode(code);
+#endif
+  }
+  
+  // This answers a request byte from the UnoJoy firmware.
+  //  That number tells us which byte of the dataForController_t struct
+  //  to send out, that the firmware wants the whole thing,
+  //  or that it wants to talk faster.
+  void handleUnoJoyRequest(byte inByte){
+    if (inByte == UNOJOY_SNAPSHOT_REQUEST){
+      lastRequestMillis = millis();
+      sendControllerDataFrame();
+    }
+    else if (inByte < sizeof(dataForController_t)){
+      // The firmware asks for the bytes in order, so we hang on to
+      //  one buffer from byte 0 on, and they all come from one update
+      if (inByte == 0)
+        servingBuffer = publishedBuffer;
+      unoJoyWrite(((uint8_t*)&controllerDataBuffers[servingBuffer])[inByte]);
+    }
+    else if (baudRateForCode(inByte) != 0)
+      acceptUnoJoyBaudRate(inByte);
+#ifndef UNOJOY_POLL_ONLY
+    else if (inByte == UNOJOY_STREAM_REQUEST){
+      lastRequestMillis = millis();
+      unoJoyStreaming = 1;
+      sendControllerDataFrame();
+    }
+#endif
+  }
+  
+#ifdef UNOJOY_USART_RESPONDER
+  // Each request from the firmware gets answered as soon as it arrives
+  ISR(UNOJOY_RX_vect){
+    uint8_t status = UCSR0A;
+    byte inByte = UDR0;
+    // If we just dropped back to 38400, this byte came in at the old rate
+    if (checkUnoJoyLinkTimeout())
+      return;
+    // Bytes with framing errors got garbled, most likely because
+    //  we're at a different rate to the firmware, so we ignore them
+    if (status & (1 << FE0))
+      return;
+    handleUnoJoyRequest(inByte);
+  }
+  
+  // This feeds our ring buffer out to the USART, then sends
+  //  any changed data setControllerData couldn't push yet
+  ISR(UNOJOY_UDRE_vect){
+    if (unoJoyTxHead != unoJoyTxTail)
+      unoJoySendNextByte();
+    else if (unoJoyStreaming && framePending){
+      // There's no timer interrupt to notice the firmware's gone quiet
+      if (!checkUnoJoyLinkTimeout())
+        sendControllerDataFrame();
+    }
+    else
+      UCSR0B &= ~(1 << UDRIE0);
+  }
+#else
   // This interrupt gets called approximately once per ms.
   //  It counts how many ms between serial port polls,
   //  and if it's been long enough, polls the serial
   //  port to see if the UnoJoy firmware requested data.
   //  If it did, it transmits the appropriate data back.
   ISR(TIMER0_COMPA_vect){
+    // If we agreed to a new rate last time around, our answer
+    //  has gone out by now, so we can switch over
+    if (pendingBaudRate != 0){
+      setUnoJoyBaudRate(pendingBaudRate);
+      pendingBaudRate = 0;
+    }
+    else
+      checkUnoJoyLinkTimeout();
     serialCheckCounter++;
     if (serialCheckCounter >= serialCheckInterval){
       serialCheckCounter = 0;
@@ -187,14 +610,15 @@
         pinMode(13, OUTPUT);
         //digitalWrite(13, HIGH);
         // Get incoming byte from the ATmega8u2
-        byte inByte = Serial.read();
-        // That number tells us which byte of the dataForController_t struct
-        //  to send out.
-        Serial.write(((uint8_t*)&controllerDataBuffer)[inByte]);
+        handleUnoJoyRequest(Serial.read());
         //digitalWrite(13, LOW);
       }
     }
+    // Send out any changed data setControllerData couldn't push yet
+    if (unoJoyStreaming && framePending)
+      pushControllerDataFrame();
   }
+#endif
   
   // Returns a zeroed out (joysticks centered) 
   //  dataForController_t variable
@@ -1,8 +1,17 @@
 
 #include "UnoJoy.h"
+#include "AnalogSampler.h"
+#include "StickConditioner.h"
+
+// The analog pins our sticks are on.  AnalogSampler.h reads these in the
+//  background, so we never have to wait for analogRead()
+const uint8_t stickPins[] = {A0, A1, A2, A3};
 
 void setup(){
   setupPins();
+  startAnalogSampler(stickPins, 4);
+  // Use the stick calibration saved in EEPROM, if there is one
+  loadStickCalibration();
   setupUnoJoy();
 }
 
@@ -52,14 +61,17 @@ dataForController_t getControllerData(void){
   controllerData.homeOn = !digitalRead(A5);
   
   // Set the analog sticks
-  //  Since analogRead(pin) returns a 10 bit value,
-  //  we need to perform a bit shift operation to
-  //  lose the 2 least significant bits and get an
-  //  8 bit number that we can use  
-  controllerData.leftStickX = analogRead(A0) >> 2;
-  controllerData.leftStickY = analogRead(A1) >> 2;
-  controllerData.rightStickX = analogRead(A2) >> 2;
-  controllerData.rightStickY = analogRead(A3) >> 2;
+  //  getAnalogSample() returns a 10 bit value, and
+  //  conditionSticks() calibrates that and turns it
+  //  into the 8 bit number that we can use
+  uint16_t rawSticks[4] = {getAnalogSample(0), getAnalogSample(1),
+                           getAnalogSample(2), getAnalogSample(3)};
+  uint8_t sticks[4];
+  conditionSticks(rawSticks, sticks);
+  controllerData.leftStickX = sticks[0];
+  controllerData.leftStickY = sticks[1];
+  controllerData.rightStickX = sticks[2];
+  controllerData.rightStickY = sticks[3];
   // And return the data!
   return controllerData;
 }
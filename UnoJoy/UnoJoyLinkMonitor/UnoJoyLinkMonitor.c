@@ -0,0 +1,162 @@
+/*  UnoJoyLinkMonitor.c
+ *
+ *  This is a little Linux tool that reads the link health and timing
+ *   counters out of a running UnoJoy, over hidraw, so you can see how
+ *   the serial link to the Arduino and the USB side are doing without
+ *   any extra wiring or a debugger.
+ *
+ *  To build it:
+ *      gcc -o UnoJoyLinkMonitor UnoJoyLinkMonitor.c
+ *
+ *  To use it:
+ *      ./UnoJoyLinkMonitor                 (finds the UnoJoy on its own)
+ *      ./UnoJoyLinkMonitor /dev/hidraw3    (or you can tell it where to look)
+ *      ./UnoJoyLinkMonitor -w              (keeps printing once a second)
+ *
+ *  You'll probably need to run it with sudo, or give yourself
+ *   permission to read the /dev/hidraw device.
+ *
+ *  The counters come from the link_stats_t struct in the UnoJoy firmware's
+ *   usb_gamepad.h - if you change that, change the layout here as well.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+// These have to match usb_gamepad.c and usb_gamepad.h in the firmware
+#define UNOJOY_VENDOR_ID 0x10C4
+#define UNOJOY_PRODUCT_ID 0x82C0
+#define LINK_STATS_REPORT_ID 2
+
+// The report is the report ID, then 12 little endian 16 bit counters
+#define LINK_STATS_FIELDS 12
+// The firmware starts the minimum fetch time off at 0xFFFF,
+//  so we know when it hasn't done any fetches yet
+#define FETCH_MIN_FIELD 5
+#define LINK_STATS_SIZE (1 + 2 * LINK_STATS_FIELDS)
+
+static const char* fieldNames[LINK_STATS_FIELDS] = {
+	"good frames",
+	"crc errors",
+	"timeouts",
+	"resyncs",
+	"sequence errors",
+	"fetch min (us)",
+	"fetch max (us)",
+	"fetch mean (us)",
+	"reports sent",
+	"send timeouts",
+	"report age max (us)",
+	"report age mean (us)",
+};
+
+// Opens the given hidraw device if it's an UnoJoy.
+//  Returns the file descriptor, or -1 if it isn't one.
+int openUnoJoy(const char* path){
+	struct hidraw_devinfo info;
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+	    (uint16_t)info.vendor != UNOJOY_VENDOR_ID ||
+	    (uint16_t)info.product != UNOJOY_PRODUCT_ID){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Looks through /dev/hidraw0 to /dev/hidraw63 for an UnoJoy
+int findUnoJoy(char* path, size_t pathLength){
+	for (int i = 0; i < 64; i++){
+		snprintf(path, pathLength, "/dev/hidraw%d", i);
+		int fd = openUnoJoy(path);
+		if (fd >= 0)
+			return fd;
+	}
+	return -1;
+}
+
+// Reads the counters from the UnoJoy and prints them out.
+//  Returns 0 if that worked, or 1 if it didn't.
+int printLinkStats(int fd){
+	uint8_t report[LINK_STATS_SIZE];
+	memset(report, 0, sizeof(report));
+	report[0] = LINK_STATS_REPORT_ID;
+	int length = ioctl(fd, HIDIOCGFEATURE(sizeof(report)), report);
+	if (length < LINK_STATS_SIZE){
+		fprintf(stderr, "Couldn't read the link stats - is the firmware up to date?\n");
+		return 1;
+	}
+	for (int i = 0; i < LINK_STATS_FIELDS; i++){
+		uint16_t value = report[1 + 2 * i] | (report[2 + 2 * i] << 8);
+		if (i == FETCH_MIN_FIELD && value == 0xFFFF)
+			printf("%-20s -\n", fieldNames[i]);
+		else
+			printf("%-20s %u\n", fieldNames[i], value);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv){
+	char path[32];
+	const char* devicePath = NULL;
+	int watch = 0;
+	int fd;
+
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-w") == 0)
+			watch = 1;
+		else
+			devicePath = argv[i];
+	}
+
+	if (devicePath != NULL){
+		fd = openUnoJoy(devicePath);
+		if (fd < 0){
+			fprintf(stderr, "%s isn't an UnoJoy, or we can't open it\n", devicePath);
+			return 1;
+		}
+	}
+	else {
+		fd = findUnoJoy(path, sizeof(path));
+		if (fd < 0){
+			fprintf(stderr, "Couldn't find an UnoJoy - is it plugged in, and can we read /dev/hidraw*?\n");
+			return 1;
+		}
+		devicePath = path;
+	}
+
+	printf("UnoJoy on %s\n", devicePath);
+	do {
+		if (printLinkStats(fd) != 0){
+			close(fd);
+			return 1;
+		}
+		if (watch){
+			printf("\n");
+			sleep(1);
+		}
+	} while (watch);
+
+	close(fd);
+	return 0;
+}
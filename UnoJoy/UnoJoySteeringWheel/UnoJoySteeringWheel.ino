@@ -18,7 +18,7 @@
 #include <UnoJoy.h>
 
 long gyroX,gyroY,gyroZ;
-float rotAngle_X,rotAngle_Y,rotAngle_Z;
+int rotAngle_Z;
 
 
 void setup() {
@@ -66,7 +66,7 @@ void setupIMU(void){
 
 
 dataForController_t getControllerData(void){
-  float steeringWheel=rotAngle();
+  int steeringWheel=rotAngle();
   // Set up a place for our controller data
   //  Use the getBlankDataForController() function, since
   //  just declaring a fresh dataForController_t tends
@@ -104,7 +104,7 @@ dataForController_t getControllerData(void){
 }
 
 
-float rotAngle(){  
+int rotAngle(){  
   
   Wire.beginTransmission(0b1101000); 
   Wire.write(0x43); 
@@ -115,9 +115,9 @@ float rotAngle(){
   gyroY = Wire.read()<<8|Wire.read(); 
   gyroZ = Wire.read()<<8|Wire.read(); 
   
-  rotAngle_X = gyroX / 655.0;
-  rotAngle_Y = gyroY / 655.0; 
-  rotAngle_Z = gyroZ / 655.0;
+  // map() only takes whole numbers anyway, so dividing in whole numbers
+  //  gives the same answer without (slow, software) floating point
+  rotAngle_Z = gyroZ / 655;
   
   rotAngle_Z = map(rotAngle_Z,-450,450,52,200);
   